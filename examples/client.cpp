@@ -14,10 +14,12 @@
  * limitations under the License.
  */
 
-#include <unordered_map>
-
 #include "core.h"
 #include "network.h"
+#include "connpool.h"
+#include "singleflight.h"
+#include "cache.h"
+#include "file.h"
 #include "portal.h"
 #include "helpers.h"
 
@@ -26,35 +28,50 @@ namespace client {
 using namespace mt;
 using namespace synca;
 
+// log-structured file: the file operations suspend the journey
+// and don't block the threads of the disk storage
 struct DiskCache
 {
+    // replays the log, must be called before the other operations
+    void open(const std::string& path)
+    {
+        log.open(path);
+        JLOG("opened: " << path << ", keys: " << log.size());
+    }
+    
     boost::optional<std::string> get(const std::string& key)
     {
         JLOG("get: " << key);
-        return boost::optional<std::string>();
+        return log.get(key);
     }
     
     void set(const std::string& key, const std::string& val)
     {
         JLOG("set: " << key << ";" << val);
+        log.set(key, val);
     }
+    
+private:
+    LogStore log;
 };
 
+// thread safe: accessed directly from any journey without teleporting
 struct MemCache
 {
+    MemCache() : cache(1024 * 1024) {}
+    
     boost::optional<std::string> get(const std::string& key)
     {
-        auto it = map.find(key);
-        return it == map.end() ? boost::optional<std::string>() : boost::optional<std::string>(it->second);
+        return cache.get(key);
     }
     
     void set(const std::string& key, const std::string& val)
     {
-        map[key] = val;
+        cache.set(key, val);
     }
     
 private:
-    std::unordered_map<std::string, std::string> map;
+    ShardedCache<std::string, std::string> cache;
 };
 
 struct Network
@@ -65,14 +82,19 @@ struct Network
     std::string get(const std::string& key)
     {
         VERIFY(port > 0, "Port must be assigned");
-        net::Socket socket;
         JLOG("connecting");
-        socket.connect("127.0.0.1", port);
-        // first byte is the string size
+        // the connection is reused by the next request
+        net::ConnectionPool::Lease conn = pool.lease("127.0.0.1", port);
+        net::Socket& socket = *conn;
         Buffer sz(1, char(key.size()));
-        socket.write(sz);
-        // then the string itself
-        socket.write(key);
+        {
+            // the request is sent by the single write on exit
+            net::Cork cork(socket);
+            // first byte is the string size
+            socket.write(sz);
+            // then the string itself
+            socket.write(key);
+        }
         // gets the result size
         socket.read(sz);
         Buffer val(size_t(sz[0]), 0);
@@ -83,8 +105,19 @@ struct Network
     }
     
     int port;
+    net::ConnectionPool pool;
 };
 
+// concurrent requests of the same key share the single call
+// of the source specified by the tag
+template<typename T_tag, typename T_val, typename F>
+T_val shared(const std::string& key, F&& f)
+{
+    return single<SingleFlight<std::string, T_val>, T_tag>().get(key, std::forward<F>(f));
+}
+
+typedef boost::optional<std::string> OptStr;
+
 struct UI : IScheduler
 {
     void schedule(Handler handler)
@@ -103,17 +136,19 @@ struct UI : IScheduler
     {
         return go([key] {
             // to implement wait correctly
-            ++ atomic<UI>();
+            ++ counter<UI>();
             
-            // timeout for all operations: 1s
-            Timeout t(1000);
+            // deadline for all operations including the child journeys: 1s
+            Deadline d(1000);
             std::string val;
             // gets the results from caches parallel
             boost::optional<std::string> result = goAnyResult<std::string>({
                 [&key] {
-                    return portal<DiskCache>()->get(key);
+                    return shared<DiskCache, OptStr>(key, [&key] {
+                        return portal<DiskCache>()->get(key);
+                    });
                 }, [&key] {
-                    return portal<MemCache>()->get(key);
+                    return single<MemCache>().get(key);
                 }
             });
             if (result)
@@ -127,9 +162,11 @@ struct UI : IScheduler
                 // caches don't contain the result
                 // loading object from network
                 {
-                    // network timeout: 0.5s
-                    Timeout tNet(500);
-                    val = portal<Network>()->get(key);
+                    // network deadline: 0.5s, only tightens the outer one
+                    Deadline dNet(500);
+                    val = shared<Network, std::string>(key, [&key] {
+                        return portal<Network>()->get(key);
+                    });
                 }
                 JLOG("net val: " << val);
                 // starting from this point
@@ -140,7 +177,7 @@ struct UI : IScheduler
                     [&key, &val] {
                         portal<DiskCache>()->set(key, val);
                     }, [&key, &val] {
-                        portal<MemCache>()->set(key, val);
+                        single<MemCache>().set(key, val);
                     }
                 });
                 JLOG("cache updated");
@@ -158,9 +195,9 @@ struct UI : IScheduler
     
     void wait()
     {
-        WAIT_FOR(atomic<UI>() != 0);
+        WAIT_FOR(counter<UI>() != 0);
         waitForAll();
-        atomic<UI>() = 0;
+        counter<UI>().reset();
     }
     
     void performHandleKey(const std::string& key)
@@ -189,11 +226,11 @@ void perform(int port)
     ThreadPool cpu(3, "cpu");
     // creates thread pool for network operations
     ThreadPool net(2, "net");
+    // creates thread pool for blocking file operations without io_uring
+    ThreadPool disk(2, "disk");
     
     // scheduler to serialize disk actions
     Alone diskStorage(cpu, "disk storage");
-    // scheduler to serialize memory actions
-    Alone memStorage(cpu, "mem storage");
     
     // sets the default scheduler
     scheduler<DefaultTag>().attach(cpu);
@@ -201,14 +238,19 @@ void perform(int port)
     service<NetworkTag>().attach(net);
     // attaches timeout service to common thread pool
     service<TimeoutTag>().attach(cpu);
+    // attaches file scheduler to disk thread pool
+    scheduler<FileTag>().attach(disk);
     
     // attaches disk cache portal to disk scheduler
     portal<DiskCache>().attach(diskStorage);
-    // attaches memory cache portal to memory scheduler
-    portal<MemCache>().attach(memStorage);
     // attaches network portal to network scheduler
     portal<Network>().attach(net);
     
+    go([] {
+        portal<DiskCache>()->open("disk_cache.log");
+    });
+    waitForAll();
+    
     UI& ui = single<UI>();
     // attaches UI portal to UI scheduler
     portal<UI>().attach(ui);
@@ -216,6 +258,7 @@ void perform(int port)
     ui.performHandleKey("Hello");
     ui.performHandleKey("Hello");
     ui.performHandleKeyCancel("Hello");
+    single<Network>().pool.clear();
 }
 
 }
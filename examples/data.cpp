@@ -27,6 +27,8 @@
 #include "mt.h"
 #include "helpers.h"
 #include "network.h"
+#include "connpool.h"
+#include "dnscache.h"
 
 #define EOL                     "\r\n"
 
@@ -81,7 +83,8 @@ StrPair parseUrl(const Str& url)
     return {host, path};
 }
 
-void parseHref(const StrPair& data, ChanStr& c)
+template<typename T_sink>
+void parseHref(const StrPair& data, T_sink& c)
 {
     static const regex e("href *= *\"([http://[\\w\\d\\._-]*[\\w\\d_-]+]?/[\\?\\&\\d\\w\\[\\]\\@\\!\\$\\'\\(\\)\\*\\+\\.%,;:/#=~_-]*)\"", regex::icase);
     auto&& host = data.first;
@@ -99,7 +102,8 @@ void parseHref(const StrPair& data, ChanStr& c)
     }
 }
 
-void parseText(const Str& content, ChanStr& para)
+template<typename T_sink>
+void parseText(const Str& content, T_sink& para)
 {
     static const regex e("<p>(.*?)</p>");
     sregex_token_iterator i = make_regex_token_iterator(content, e, 1);
@@ -110,7 +114,8 @@ void parseText(const Str& content, ChanStr& para)
     }
 }
 
-void excludeTags(const Str& para, ChanStr& text)
+template<typename T_sink>
+void excludeTags(const Str& para, T_sink& text)
 {
     static const regex e("(<.*?>)");
     sregex_token_iterator i = make_regex_token_iterator(para, e, 1);
@@ -124,7 +129,8 @@ void excludeTags(const Str& para, ChanStr& text)
     text.put({s, para.end()});
 }
 
-void splitWords(const Str& text, ChanStr& words)
+template<typename T_sink>
+void splitWords(const Str& text, T_sink& words)
 {
     static const regex e("([a-zA-Z]+)");
     sregex_token_iterator i = make_regex_token_iterator(text, e, 1);
@@ -156,37 +162,35 @@ private:
     mutable std::unordered_set<Str> processed;
 };
 
+// keep-alive connections, the hostnames are resolved once per ttl
+// by the single lookup for all concurrent loaders
+ConnectionPool& connections()
+{
+    static ConnectionPool pool([] {
+        PoolOptions options;
+        options.resolver = &single<CachingResolver>();
+        return options;
+    }());
+    return pool;
+}
+
 StrPair loadContent(const StrPair& url)
 {
-    const int MAX_BUF_SIZE = 1024*1000;
-    const int READ_BUF_SIZE = 1024*16;
+    const size_t MAX_BUF_SIZE = 1024*1000;
 
     auto&& host = url.first;
     auto&& path = url.second;
     JLOG("loading url: " << host << ", " << path);
-    Resolver r;
-    EndPoints ends = r.resolve(host, 80);
-    VERIFY(ends != EndPoints(), "Cannot resolve hostname: " + host);
-    Socket s;
-    s.connect(*ends);
+    // keep-alive connection to the host
+    ConnectionPool::Lease conn = connections().lease(host, 80);
+    Socket& s = *conn;
     Str req =
         "GET " + path + " HTTP/1.1" EOL
         "Host: " + host + EOL EOL;
     s.write(req);
-    Str resp;
-    Str buf;
-    size_t header = std::string::npos;
-    while (header == std::string::npos)
-    {
-        VERIFY(resp.size() < MAX_BUF_SIZE, "Header is too large");
-        buf.resize(READ_BUF_SIZE);
-        s.partialRead(buf);
-        VERIFY(!buf.empty(), "Empty buffer on partial read");
-        resp += buf;
-        header = resp.find(EOL EOL);
-    }
-    Str head = resp.substr(0, header);
-    header += 4; // add 2 EOLs
+    // the data read after the header stays in the reader buffer
+    StreamReader reader(s);
+    Str head = reader.readUntil(EOL EOL, MAX_BUF_SIZE);
     static const regex eStatus("^http/1\\.[01] ([\\d]{3})", regex::icase);
     smatch whatStatus;
     bool result = regex_search(head, whatStatus, eStatus);
@@ -197,30 +201,36 @@ StrPair loadContent(const StrPair& url)
     static const regex e("content-length: *(\\d+)", regex::icase);
     smatch what;
     result = regex_search(head, what, e);
+    Str body;
     if (result)
     {
-        int len = std::atoi(Str(what[1]).c_str());
+        size_t len = std::atoi(Str(what[1]).c_str());
         VERIFY(len > 0 && len < MAX_BUF_SIZE, "Content length: invalid value");
-        buf.resize(len - (resp.size() - header));
-        s.read(buf);
-        resp += buf;
+        body = reader.readExactly(len);
     }
     else
     {
         static const regex et("transfer-encoding: *chunked", regex::icase);
-        // read chunks
         result = regex_search(head, et);
         VERIFY(result, "Either content-length or transfer-encoding must be present in header");
-        while (resp.find(EOL EOL, resp.size() - 4) == std::string::npos)
+        // read chunks: the hex size line, the data and the line ending
+        while (true)
         {
-            VERIFY(resp.size() < MAX_BUF_SIZE, "Response is too large");
-            buf.resize(READ_BUF_SIZE);
-            s.partialRead(buf);
-            VERIFY(!buf.empty(), "Empty buffer on partial read");
-            resp += buf;
+            size_t size = std::strtoul(reader.readLine().c_str(), nullptr, 16);
+            if (size == 0)
+                break;
+            VERIFY(body.size() + size < MAX_BUF_SIZE, "Response is too large");
+            body += reader.readExactly(size);
+            reader.readLine();
         }
+        // the trailer ends with the empty line
+        while (!reader.readLine().empty())
+            ;
     }
-    Str body = resp.substr(header);
+    // the connection is reused only after the whole response is read
+    static const regex eClose("connection: *close", regex::icase);
+    if (regex_search(head, eClose) || reader.buffered() != 0)
+        conn.close();
     return {host, body};
 }
 
@@ -232,15 +242,17 @@ void processing()
     scheduler<DefaultTag>().attach(tp);
     service<NetworkTag>().attach(tp);
 
+    // urls go through the cycle, so only the downstream stages are bounded
+    const size_t CAPACITY = 100;
     ChanStr url;
     ChanStr filteredUrl;
     ChanStrPair parsedUrl;
-    ChanStrPair content;
+    ChanStrPair content(CAPACITY);
     ChanStrPair contentHref;
-    ChanStr contentText;
-    ChanStr contentParagraph;
-    ChanStr text;
-    ChanStr words;
+    ChanStr contentText(CAPACITY);
+    ChanStr contentParagraph(CAPACITY);
+    ChanStr text(CAPACITY);
+    ChanStr words(CAPACITY);
     
     UrlFilter urlFilter("boost.org", 1000);
     
@@ -256,15 +268,16 @@ void processing()
             contentText.put(c.second);
         }
     });
-    piping1toMany(contentHref, url, parseHref);
-    piping1toMany(contentText, contentParagraph, parseText);
-    piping1toMany(contentParagraph, text, excludeTags);
-    piping1toMany(text, words, splitWords);
+    // each input fans out to many outputs: put them by batches
+    piping1toManyBatch(contentHref, url, parseHref<Batch<Str>>);
+    piping1toManyBatch(contentText, contentParagraph, parseText<Batch<Str>>);
+    piping1toManyBatch(contentParagraph, text, excludeTags<Batch<Str>>);
+    piping1toManyBatch(text, words, splitWords<Batch<Str>>);
     
     std::unordered_map<Str, int> countedWords;
     
     go([&] {
-        for (auto&& c: words)
+        for (auto&& c: drain(words, BATCH_SIZE))
         {
             boost::algorithm::to_lower(c);
             ++ countedWords[c];
@@ -273,6 +286,7 @@ void processing()
     
     url.put("http://www.boost.org");
     closeAndWait(tp, url);
+    connections().clear();
     static const size_t WORDS_COUNT = 20;
     std::vector<std::pair<Str, int>> wordsOut;
     typedef std::vector<std::pair<Str, int>>::const_reference CRef;
@@ -51,28 +51,25 @@ std::unordered_map<Socket*, ChatUser> chatMap;
 struct TimeoutSocketTag;
 struct TimeoutSocket {
     TimeoutSocket(int ms, const Handler& inCallback):
-        timer(service<TimeoutSocketTag>(), boost::posix_time::milliseconds(ms)),
         callback(inCallback)
     {
         Goer goer = journey().goer();
-        timer.async_wait([this, goer](const boost::system::error_code& error) mutable {
-            if (!error){
-                if(callback){
-                    callback();
-                }
-                goer.timedout();
+        timer.start(wheel<TimeoutSocketTag>(), ms, [this, goer]() mutable {
+            if(callback){
+                callback();
             }
+            goer.timedout();
         });
     }
     
     ~TimeoutSocket(){
-        timer.cancel_one();
+        timer.cancel();
         handleEvents();
     }
     
 private:
-    boost::asio::deadline_timer timer;
     Handler callback;
+    WheelTimer timer;
 };
 
 void serve(int port)
@@ -99,6 +96,8 @@ void serve(int port)
                 }
                 
                 JLOG("accepted");
+                // данные, прочитанные после перевода строки, остаются в буфере
+                StreamReader reader(*socketPtr);
                 // работаем с сокетом в цикле
                 while (true) {
                     if (socket.expired()) {
@@ -114,13 +113,7 @@ void serve(int port)
                     if(curUser.state == State::NO_NAME){
                         socket.lock()->write("Enter name:\n");
                         
-                        Buffer userName(64, 0);
-                        socketPtr->readUntil(userName, Buffer("\n"));
-                        
-                        size_t index = userName.find("\r\n", 0);
-                        if (index != std::string::npos){
-                            userName.replace(index, 2, "\0\0");
-                        }
+                        Buffer userName = reader.readLine(64);
                         
                         curUser.name = userName;
                         curUser.state = State::WITH_NAME;
@@ -129,8 +122,8 @@ void serve(int port)
                     
                     socket.lock()->write("Enter message: ");
                     
-                    // читаем пока не завершится или не закончится буффер
-                    Buffer message(64, 0);
+                    // читаем строку
+                    Buffer message;
                     {
                         string userName = curUser.name;
                     
@@ -153,12 +146,7 @@ void serve(int port)
                             }
                             mutex.unlock();
                         });
-                        socketPtr->readUntil(message, Buffer("\n"));
-                    }
-                    
-                    size_t index = message.find("\r\n", 0);
-                    if (index != std::string::npos){
-                        message.replace(index, 2, "\0\0");
+                        message = reader.readLine();
                     }
                     
                     // выход из чата
@@ -203,50 +191,61 @@ void serve(int port)
 void echo(int port)
 {
     ThreadPool net(4, "net");
+    // однопоточный обработчик на каждый приемщик: соединения
+    // обрабатываются в потоке своего приемщика
+    const int workers = 4;
+    std::vector<std::unique_ptr<ThreadPool>> pools;
+    std::vector<IScheduler*> schedulers;
+    for (int i = 0; i < workers; ++ i) {
+        pools.emplace_back(new ThreadPool(1, "worker"));
+        schedulers.push_back(pools.back().get());
+    }
     
     service<NetworkTag>().attach(net);
     service<TimeoutSocketTag>().attach(net);
     scheduler<DefaultTag>().attach(net);
     
-    Handler handler = [port] {
+    Handler handler = [port, &schedulers] {
         enableEvents();
         
-        // создаем приемник соединений
-        Acceptor acceptor(port);
+        // приемщики на одном порту (SO_REUSEPORT), ожидающие
+        // соединения забираются пачкой
+        AcceptorOptions options;
+        options.batch = 16;
+        options.noDelay = true;
+        MultiAcceptor acceptor(port, schedulers, options);
         
-        // ожидаем подключения
-        while (true){
-            SocketHandler socketHandler = [](const std::weak_ptr<Socket>& socket) {
-                Socket* socketPtr = nullptr;
-                if (socket.expired() == false) {
-                    socketPtr = socket.lock().get();
-                }
-                
-                // читаем пока не завершится или не закончится буффер
-                Buffer message(64, 0);
-                {
-                    TimeoutSocket t(5000, [socketPtr](){
-                        // закрываем сокет по таймауту
-                        socketPtr->close();
-                    });
-                    socketPtr->readUntil(message, Buffer("\n"));
-                }
-                
-                // Пишем
-                {
-                    TimeoutSocket t(5000, [socketPtr](){
-                        // закрываем сокет по таймауту
-                        socketPtr->close();
-                    });
-                    socketPtr->write(message);
-                }
-                
-                socketPtr->close();
-            };
+        SocketHandler socketHandler = [](const std::weak_ptr<Socket>& socket) {
+            Socket* socketPtr = nullptr;
+            if (socket.expired() == false) {
+                socketPtr = socket.lock().get();
+            }
             
-            // Работа непосредственно с открытым соединением
-            acceptor.goAccept(socketHandler);
-        }
+            // читаем строку вместе с переводом строки
+            Buffer message;
+            {
+                TimeoutSocket t(5000, [socketPtr](){
+                    // закрываем сокет по таймауту
+                    socketPtr->close();
+                });
+                StreamReader reader(*socketPtr);
+                message = reader.readUntil("\n");
+            }
+            
+            // Пишем
+            {
+                TimeoutSocket t(5000, [socketPtr](){
+                    // закрываем сокет по таймауту
+                    socketPtr->close();
+                });
+                socketPtr->write(message);
+            }
+            
+            socketPtr->close();
+        };
+        
+        // Работа непосредственно с открытым соединением
+        acceptor.serve(socketHandler);
     };
     go(handler, net);
 }
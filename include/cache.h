@@ -0,0 +1,222 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include <boost/optional.hpp>
+
+#include "helpers.h"
+
+namespace synca {
+
+// bytes accounted for the cache entry part
+template<typename T>
+size_t cacheSize(const T&) {
+    return sizeof(T);
+}
+
+inline size_t cacheSize(const std::string& s) {
+    return s.size();
+}
+
+struct CacheStats {
+    int64_t hits;
+    int64_t misses;
+    int64_t inserts;
+    int64_t evictions;
+    size_t entries;
+    size_t bytes;
+
+    double hitRatio() const {
+        int64_t total = hits + misses;
+        return total == 0 ? 0 : double(hits) / total;
+    }
+};
+
+// Concurrent cache with the byte size budget. The keys are distributed
+// between the shards having their own lock and the equal part of the
+// budget. The shard evicts the entries by the CLOCK algorithm: the hand
+// sweeps the ring clearing the reference bits set by the lookups and
+// evicts the first entry not referenced since the previous sweep.
+// The operations don't suspend the journey and may be called from any
+// thread. The value is copied on lookup.
+template<typename T_key, typename T_value, typename T_hash = std::hash<T_key>>
+struct ShardedCache {
+    static const size_t DEFAULT_SHARDS = 16;
+
+    explicit ShardedCache(size_t budgetBytes, size_t shardCount = DEFAULT_SHARDS) :
+        shards(shardCount) {
+        VERIFY(shardCount > 0, "Cache must have shards");
+        for (Shard& s: shards)
+            s.budget = budgetBytes / shardCount;
+    }
+
+    ShardedCache(const ShardedCache&) = delete;
+    ShardedCache& operator=(const ShardedCache&) = delete;
+
+    boost::optional<T_value> get(const T_key& key) {
+        Shard& s = shard0(key);
+        Lock lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) {
+            ++ s.misses;
+            return boost::optional<T_value>();
+        }
+        ++ s.hits;
+        Slot& slot = s.ring[it->second];
+        slot.referenced = true;
+        return boost::optional<T_value>(slot.value);
+    }
+
+    // returns false if the entry exceeds the shard budget
+    bool set(const T_key& key, T_value value) {
+        size_t bytes = cacheSize(key) + cacheSize(value);
+        Shard& s = shard0(key);
+        Lock lock(s.mutex);
+        if (bytes > s.budget)
+            return false;
+        auto it = s.index.find(key);
+        if (it != s.index.end())
+            remove0(s, it->second);
+        while (s.bytes + bytes > s.budget)
+            evict0(s);
+        size_t i;
+        if (s.free.empty()) {
+            i = s.ring.size();
+            s.ring.emplace_back();
+        } else {
+            i = s.free.back();
+            s.free.pop_back();
+        }
+        Slot& slot = s.ring[i];
+        slot.key = key;
+        slot.value = std::move(value);
+        slot.bytes = bytes;
+        slot.used = true;
+        // the entry not looked up before the sweep is evicted first
+        slot.referenced = false;
+        s.index.emplace(key, i);
+        s.bytes += bytes;
+        ++ s.inserts;
+        return true;
+    }
+
+    bool erase(const T_key& key) {
+        Shard& s = shard0(key);
+        Lock lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end())
+            return false;
+        remove0(s, it->second);
+        return true;
+    }
+
+    void clear() {
+        for (Shard& s: shards) {
+            Lock lock(s.mutex);
+            s.index.clear();
+            s.ring.clear();
+            s.free.clear();
+            s.hand = 0;
+            s.bytes = 0;
+        }
+    }
+
+    CacheStats stats() const {
+        CacheStats st = {};
+        for (const Shard& s: shards) {
+            Lock lock(s.mutex);
+            st.hits += s.hits;
+            st.misses += s.misses;
+            st.inserts += s.inserts;
+            st.evictions += s.evictions;
+            st.entries += s.index.size();
+            st.bytes += s.bytes;
+        }
+        return st;
+    }
+
+private:
+    typedef std::unique_lock<std::mutex> Lock;
+
+    struct Slot {
+        T_key key;
+        T_value value;
+        size_t bytes = 0;
+        bool used = false;
+        bool referenced = false;
+    };
+
+    // padded to avoid false sharing of the neighbour locks
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<T_key, size_t, T_hash> index;
+        std::vector<Slot> ring;
+        std::vector<size_t> free;
+        size_t hand = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+        int64_t hits = 0;
+        int64_t misses = 0;
+        int64_t inserts = 0;
+        int64_t evictions = 0;
+        char pad[64];
+    };
+
+    Shard& shard0(const T_key& key) {
+        size_t h = T_hash()(key);
+        // the map of the shard uses the low bits of the same hash
+        return shards[(h ^ (h >> 16)) % shards.size()];
+    }
+
+    void remove0(Shard& s, size_t i) {
+        Slot& slot = s.ring[i];
+        s.index.erase(slot.key);
+        s.bytes -= slot.bytes;
+        slot = Slot();
+        s.free.push_back(i);
+    }
+
+    // the shard has the entries if its bytes are not zero
+    void evict0(Shard& s) {
+        while (true) {
+            if (s.hand >= s.ring.size())
+                s.hand = 0;
+            Slot& slot = s.ring[s.hand];
+            size_t i = s.hand ++;
+            if (!slot.used)
+                continue;
+            if (slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+            remove0(s, i);
+            ++ s.evictions;
+            return;
+        }
+    }
+
+    std::vector<Shard> shards;
+};
+
+}
@@ -18,29 +18,49 @@
 
 #include <queue>
 #include <mutex>
+#include <atomic>
+#include <vector>
+#include <iterator>
 
 #include "core.h"
 #include "helpers.h"
 
 namespace synca {
 
-// with iterators
+template<typename T>
+struct SelectGet;
+template<typename T>
+struct SelectPut;
+
+// Channel with iterators.
+// Bounded channel suspends the sender journey while the buffer is full,
+// zero capacity channel passes the value directly from the sender
+// to the receiver (rendezvous). Closing wakes up both receivers and senders.
 template<typename T>
 struct Channel {
 private:
+    template<typename U>
+    friend struct SelectGet;
+    template<typename U>
+    friend struct SelectPut;
+
     struct Waiters;
     struct Waiter {
         friend struct Waiters;
 
         Waiter(T& v) : val(&v) {}
 
-        void proceed(T&& v) {
+        void store(T&& v) {
             *val = std::move(v);
-            proc();
         }
 
-        void proceed() {
-            val = nullptr;
+        // sender: the value to be taken by the receiver
+        T&& value() {
+            return std::move(*val);
+        }
+
+        void complete(bool done_) {
+            done = done_;
             proc();
         }
 
@@ -48,44 +68,91 @@ private:
             proc = std::move(proceed);
         }
 
-        bool hasValue() const {
-            return val != nullptr;
+        // the waiter of the select case
+        void setSelect(std::atomic<int>& selected_, int index_, Handler&& proceed) {
+            selected = &selected_;
+            index = index_;
+            proc = std::move(proceed);
+        }
+
+        // the select waiter may be completed only if its case is
+        // the first one, otherwise the waiter is dropped
+        bool claim() {
+            int none = -1;
+            return selected == nullptr || selected->compare_exchange_strong(none, index);
+        }
+
+        bool completed() const {
+            return done;
         }
 
     private:
         Handler proc;
         Waiter* next = nullptr;
         T* val;
+        std::atomic<int>* selected = nullptr;
+        int index = 0;
+        bool done = false;
     };
 
+    // intrusive FIFO list
     struct Waiters {
         Waiter* pop() {
             if (!root)
                 return nullptr;
             Waiter* w = root;
             root = root->next;
+            if (!root)
+                last = nullptr;
             return w;
         }
 
-        Waiters popAll() {
-            Waiters w;
-            w.root = root;
-            root = nullptr;
+        // skips the waiters of the fired selects
+        Waiter* popClaimed() {
+            Waiter* w = pop();
+            while (w && !w->claim())
+                w = pop();
             return w;
         }
 
         void push(Waiter& w) {
-            w.next = root;
-            root = &w;
+            w.next = nullptr;
+            if (last)
+                last->next = &w;
+            else
+                root = &w;
+            last = &w;
+        }
+
+        // returns false if the waiter is not in the list
+        bool remove(Waiter& w) {
+            Waiter* prev = nullptr;
+            for (Waiter* cur = root; cur; prev = cur, cur = cur->next) {
+                if (cur != &w)
+                    continue;
+                if (prev)
+                    prev->next = cur->next;
+                else
+                    root = cur->next;
+                if (last == cur)
+                    last = prev;
+                return true;
+            }
+            return false;
         }
 
     private:
         Waiter* root = nullptr;
+        Waiter* last = nullptr;
     };
 
     typedef std::unique_lock<std::mutex> Lock;
 
 public:
+    typedef T value_type;
+
+    static const size_t UNBOUNDED = size_t(-1);
+
     struct Iterator {
         Iterator() = default;
         Iterator(Channel& c) : ch(&c)            {
@@ -107,6 +174,9 @@ public:
         Channel* ch = nullptr;
     };
 
+    Channel() : cap(UNBOUNDED) {}
+    explicit Channel(size_t capacity) : cap(capacity) {}
+
     Iterator begin()                             {
         return {*this};
     }
@@ -114,34 +184,77 @@ public:
         return {};
     }
 
-    void put(T val) {
+    // returns false if the channel is closed, the value is dropped,
+    // suspends the journey while the buffer is full
+    bool put(T val) {
+        Waiters woken;
         Lock lock(mutex);
-        Waiter* w = waiters.pop();
-        if (w) {
-            lock.unlock();
-            w->proceed(std::move(val));
-        } else {
-            queue.emplace(std::move(val));
-        }
+        if (closed)
+            return false;
+        if (!give0(val, woken))
+            return wait0(senders, val, lock);
+        lock.unlock();
+        complete0(woken);
+        return true;
     }
 
     bool get(T& val) {
+        Waiters woken;
         Lock lock(mutex);
-        if (!queue.empty()) {
-            val = std::move(queue.front());
-            queue.pop();
-            return true;
+        if (!take0(val, woken)) {
+            if (closed)
+                return false;
+            return wait0(receivers, val, lock);
         }
+        lock.unlock();
+        complete0(woken);
+        return true;
+    }
+
+    // puts the values using the single lock acquisition while
+    // the buffer has the room, the rest is put one by one
+    template<typename T_it>
+    bool putMany(T_it first, T_it last) {
+        Waiters woken;
+        Lock lock(mutex);
         if (closed)
             return false;
-        Waiter w(val);
-        waiters.push(w);
-        lock.release();
-        deferProceed([this, &w](Handler proceed) {
-            w.setProceed(std::move(proceed));
-            mutex.unlock();
-        });
-        return w.hasValue();
+        for (; first != last; ++ first) {
+            T val(*first);
+            if (give0(val, woken))
+                continue;
+            lock.unlock();
+            complete0(woken);
+            if (!put(std::move(val)))
+                return false;
+            for (++ first; first != last; ++ first)
+                if (!put(*first))
+                    return false;
+            return true;
+        }
+        lock.unlock();
+        complete0(woken);
+        return true;
+    }
+
+    template<typename T_range>
+    bool putMany(T_range&& values) {
+        return putMany(std::begin(values), std::end(values));
+    }
+
+    // appends up to maxN values to out: takes buffered values using
+    // the single lock acquisition or waits for the first value,
+    // returns 0 if the channel is closed and drained
+    size_t getMany(std::vector<T>& out, size_t maxN) {
+        VERIFY(maxN > 0, "Batch size must be positive");
+        size_t n = tryGetMany0(out, maxN);
+        if (n > 0)
+            return n;
+        T val;
+        if (!get(val))
+            return 0;
+        out.emplace_back(std::move(val));
+        return 1 + tryGetMany0(out, maxN - 1);
     }
 
     bool empty() const {
@@ -149,6 +262,10 @@ public:
         return queue.empty();
     }
 
+    size_t capacity() const {
+        return cap;
+    }
+
     T get() {
         T val;
         get(val);
@@ -161,21 +278,158 @@ public:
     }
 
     void close() {
+        Waiters woken;
         Lock lock(mutex);
         if (closed)
             return;
         closed = true;
-        Waiters ws = waiters.popAll();
+        for (Waiter* w = receivers.popClaimed(); w; w = receivers.popClaimed())
+            woken.push(*w);
+        for (Waiter* w = senders.popClaimed(); w; w = senders.popClaimed())
+            woken.push(*w);
         lock.unlock();
-        for (Waiter* w = ws.pop(); w; w = ws.pop())
-            w->proceed();
+        for (Waiter* w = woken.pop(); w; w = woken.pop())
+            w->complete(false);
     }
 
 private:
-    Waiters waiters;
+    // takes the value from the buffer or from the blocked sender,
+    // the sender to be completed after unlock is added to woken
+    bool take0(T& val, Waiters& woken) {
+        if (!queue.empty()) {
+            val = std::move(queue.front());
+            queue.pop();
+            // the freed slot goes to the blocked sender
+            Waiter* w = senders.popClaimed();
+            if (w) {
+                queue.emplace(w->value());
+                woken.push(*w);
+            }
+            return true;
+        }
+        // rendezvous
+        Waiter* w = senders.popClaimed();
+        if (!w)
+            return false;
+        val = w->value();
+        woken.push(*w);
+        return true;
+    }
+
+    // gives the value to the waiting receiver or puts it into the buffer
+    bool give0(T& val, Waiters& woken) {
+        Waiter* w = receivers.popClaimed();
+        if (w) {
+            w->store(std::move(val));
+            woken.push(*w);
+            return true;
+        }
+        if (queue.size() < cap) {
+            queue.emplace(std::move(val));
+            return true;
+        }
+        return false;
+    }
+
+    size_t tryGetMany0(std::vector<T>& out, size_t maxN) {
+        Waiters woken;
+        size_t n = 0;
+        {
+            Lock lock(mutex);
+            T val;
+            for (; n < maxN && take0(val, woken); ++ n)
+                out.emplace_back(std::move(val));
+        }
+        complete0(woken);
+        return n;
+    }
+
+    static void complete0(Waiters& ws) {
+        for (Waiter* w = ws.pop(); w; w = ws.pop())
+            w->complete(true);
+    }
+
+    // suspends the journey until the counterpart completes the waiter,
+    // the mutex is released after the journey is suspended,
+    // the event removes the waiter unless it's already taken
+    bool wait0(Waiters& ws, T& val, Lock& lock) {
+        Waiter w(val);
+        ws.push(w);
+        lock.release();
+        deferAbortable([this, &w](Handler proceed) {
+            w.setProceed(std::move(proceed));
+            mutex.unlock();
+        }, [this, &ws, &w] {
+            Lock l(mutex);
+            if (!ws.remove(w))
+                return;
+            l.unlock();
+            w.complete(false);
+        });
+        return w.completed();
+    }
+
+    Waiters receivers;
+    Waiters senders;
     mutable std::mutex mutex;
     std::queue<T> queue;
+    size_t cap;
     bool closed = false;
 };
 
+// Iterates over the channel values taking up to n buffered values
+// per wakeup: for (auto&& v: drain(channel, 64))
+template<typename T_channel>
+struct Drain {
+    typedef typename T_channel::value_type value_type;
+
+    struct Iterator {
+        Iterator() = default;
+        Iterator(Drain& d_) : d(&d_)             {
+            ++*this;
+        }
+
+        value_type& operator*()                  {
+            return d->values[d->pos];
+        }
+        Iterator& operator++()                   {
+            if (!d->next0()) d = nullptr;
+            return *this;
+        }
+        bool operator!=(const Iterator& i) const {
+            return d != i.d;
+        }
+    private:
+        Drain* d = nullptr;
+    };
+
+    Drain(T_channel& c, size_t n) : ch(&c), batch(n) {}
+
+    Iterator begin()                             {
+        return {*this};
+    }
+    static Iterator end()                        {
+        return {};
+    }
+
+private:
+    bool next0() {
+        if (++ pos < values.size())
+            return true;
+        values.clear();
+        pos = 0;
+        return ch->getMany(values, batch) > 0;
+    }
+
+    T_channel* ch;
+    size_t batch;
+    size_t pos = 0;
+    std::vector<value_type> values;
+};
+
+template<typename T_channel>
+Drain<T_channel> drain(T_channel& c, size_t n) {
+    return {c, n};
+}
+
 }
@@ -19,6 +19,8 @@
 #include <string>
 #include <functional>
 #include <atomic>
+#include <cstdint>
+#include <cstddef>
 
 typedef std::string Buffer;
 typedef std::function<void ()> Handler;
@@ -35,11 +37,69 @@ T& single() {
 
 template<typename T>
 struct Atomic : std::atomic<T> {
-    Atomic(int v = 0) : std::atomic<T>(v) {}
+    Atomic(T v = 0) : std::atomic<T>(v) {}
 };
 
+// unique sequence numbers, use counter<T>() for statistics
 template<typename T>
-std::atomic<int>& atomic() {
-    return single<Atomic<int>, T>();
+std::atomic<int64_t>& atomic() {
+    return single<Atomic<int64_t>, T>();
+}
+
+// slot of the current thread in the sharded counters
+size_t counterSlot();
+
+// Counter with per-thread slots padded to the cache line: increments
+// from different threads don't contend, the value is the sum of slots.
+// The value read concurrently with increments is not a snapshot.
+struct ShardedCounter {
+    static const size_t SLOTS = 64;
+
+    ShardedCounter& operator+=(int64_t v) {
+        slots[counterSlot()].value.fetch_add(v, std::memory_order_release);
+        return *this;
+    }
+
+    ShardedCounter& operator-=(int64_t v) {
+        return *this += -v;
+    }
+
+    ShardedCounter& operator++() {
+        return *this += 1;
+    }
+
+    ShardedCounter& operator--() {
+        return *this += -1;
+    }
+
+    int64_t value() const {
+        int64_t sum = 0;
+        for (const Slot& s: slots)
+            sum += s.value.load(std::memory_order_acquire);
+        return sum;
+    }
+
+    operator int64_t() const {
+        return value();
+    }
+
+    // must not be called concurrently with increments
+    void reset() {
+        for (Slot& s: slots)
+            s.value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<int64_t> value{0};
+        char pad[64 - sizeof(std::atomic<int64_t>)];
+    };
+
+    Slot slots[SLOTS];
+};
+
+template<typename T>
+ShardedCounter& counter() {
+    return single<ShardedCounter, T>();
 }
 
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "network.h"
+
+namespace synca {
+namespace net {
+
+struct CachingResolver;
+
+struct PoolOptions {
+    // per host limits: idle connections and all connections
+    // including the leased and connecting ones
+    size_t maxIdle = 8;
+    size_t maxTotal = 64;
+    // the idle connections are closed after the timeout
+    int idleTimeoutMs = 30000;
+    int evictPeriodMs = 1000;
+    // the hostnames are resolved by Resolver if not specified
+    CachingResolver* resolver = nullptr;
+};
+
+struct PoolStats {
+    int64_t created;
+    int64_t reused;
+    int64_t broken;     // idle connections failed the health check
+    int64_t evicted;    // idle connections closed by the timeout
+    int64_t waited;     // leases suspended on the exhausted pool
+};
+
+// Pool of the outbound connections keyed by host and port.
+// The lease of the exhausted host suspends the journey until another
+// lease returns the connection. The idle connection is checked before
+// reuse: the connection closed by the peer or having unread data is
+// dropped. The pool may be destroyed before the leases.
+struct ConnectionPool {
+    struct State;
+
+    // Leased connection, returned to the pool on destruction unless
+    // closed or destroyed by the exception
+    struct Lease {
+        Lease(Lease&&) = default;
+        ~Lease();
+
+        Socket& operator*();
+        Socket* operator->();
+        // the connection is not returned to the pool
+        void close();
+
+    private:
+        friend struct ConnectionPool;
+
+        Lease(const std::shared_ptr<State>& state, const std::string& key,
+            std::unique_ptr<Socket> socket);
+
+        std::shared_ptr<State> state;
+        std::string key;
+        std::unique_ptr<Socket> socket;
+    };
+
+    explicit ConnectionPool(const PoolOptions& options = PoolOptions());
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // the host is either the ip address or the resolved hostname
+    Lease lease(const std::string& host, int port);
+    PoolStats stats() const;
+    // closes the idle connections, must be called before
+    // the network service is stopped if the pool outlives it
+    void clear();
+
+private:
+    std::shared_ptr<State> state;
+};
+
+}
+}
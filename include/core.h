@@ -18,9 +18,15 @@
 
 #include <boost/optional.hpp>
 #include <atomic>
+#include <mutex>
+#include <exception>
+#include <type_traits>
+#include <limits>
 
 #include "mt.h"
 #include "goer.h"
+#include "task.h"
+#include "wheel.h"
 
 #define  JLOG(D_msg)             TLOG("[" << synca::index() << "] " << D_msg)
 #define RJLOG(D_msg)            RTLOG("[" << synca::index() << "] " << D_msg)
@@ -29,18 +35,36 @@ namespace synca {
 
 typedef std::function<void(Handler)> ProceedHandler;
 
-int index();
-Goer go(Handler handler, mt::IScheduler& scheduler);
-Goer go(Handler handler);
+int64_t index();
+Goer go(Task handler, mt::IScheduler& scheduler);
+Goer go(Task handler);
 void goN(int n, Handler handler);
 
+// the same using specified coroutine stack size
+Goer go(Task handler, mt::IScheduler& scheduler, size_t stackSize);
+Goer go(Task handler, size_t stackSize);
+void goN(int n, Handler handler, size_t stackSize);
+
 void teleport(mt::IScheduler& scheduler);
 void handleEvents();
 void disableEvents();
 void enableEvents();
+bool eventsEnabled();
 void waitForAll();
+
+// Direct handoff: the journey proceeded by another journey on the same
+// scheduler runs on the current thread right after the current step
+// instead of going through the scheduler queue. Disabled by default.
+void enableHandoff(bool enabled = true);
+
 void defer(Handler handler);
 void deferProceed(ProceedHandler proceed);
+// Suspends the journey like deferProceed, the abort handler is invoked
+// on cancel or timeout while suspended and must resume the journey
+// unless it's already resumed. The start handler is always invoked,
+// so it may release the resources locked before the suspension.
+// The event is thrown after the resumption.
+void deferAbortable(ProceedHandler start, Handler abort);
 void goWait(std::initializer_list<Handler> handlers);
 
 struct EventsGuard {
@@ -48,18 +72,117 @@ struct EventsGuard {
     ~EventsGuard();
 };
 
-struct Waiter {
-    Waiter();
-    ~Waiter();
-
-    Waiter& go(Handler h);
+// Structured group of journeys (nursery): members are spawned into
+// the group and the owner journey waits for all of them or for the first
+// completed one. Running members are tracked by the intrusive list
+// of records kept on their own stacks. The first member error cancels
+// the rest and is rethrown by wait, cancellation events caused by
+// the group are not errors. The destructor cancels and waits for
+// the remaining members, so it must be called inside the journey.
+struct JourneyGroup {
+    static const size_t NONE = size_t(-1);
+
+    JourneyGroup();
+    ~JourneyGroup();
+
+    JourneyGroup(const JourneyGroup&) = delete;
+    JourneyGroup& operator=(const JourneyGroup&) = delete;
+
+    // spawns the member using the default scheduler,
+    // returns the member index in the group
+    template<typename F>
+    size_t go(F&& f) {
+        return go0(std::forward<F>(f), nullptr);
+    }
+
+    template<typename F>
+    size_t go(F&& f, mt::IScheduler& s) {
+        return go0(std::forward<F>(f), &s);
+    }
+
+    // waits for all members, rethrows the first member error
     void wait();
+    // waits for the first completed member, cancels the rest and waits
+    // for them, returns the index of the first member or rethrows
+    // the error if no member has completed
+    size_t waitAny();
+    // cancels the running members, members not yet started are skipped
+    void cancel();
 
 private:
-    void init0();
+    struct Member {
+        Member(JourneyGroup& g, size_t index);
+        ~Member();
+
+        bool cancelled() const;
+        void fail(bool event);
+
+    private:
+        friend struct JourneyGroup;
+
+        JourneyGroup& group;
+        Goer goer;
+        Member* prev = nullptr;
+        Member* next = nullptr;
+        size_t index;
+        std::exception_ptr error;
+        bool event = false;
+        bool skipped = false;
+    };
+
+    // the member journey task
+    template<typename Fn>
+    struct Run {
+        void operator()() {
+            Member m(*group, index);
+            try {
+                if (!m.cancelled())
+                    fn();
+            } catch (EventException&) {
+                m.fail(true);
+            } catch (...) {
+                m.fail(false);
+            }
+        }
 
+        JourneyGroup* group;
+        size_t index;
+        Fn fn;
+    };
+
+    template<typename F>
+    size_t go0(F&& f, mt::IScheduler* s) {
+        size_t index = spawn0();
+        start0(Run<typename std::decay<F>::type>{this, index, std::forward<F>(f)}, s);
+        return index;
+    }
+
+    size_t spawn0();
+    void start0(Task task, mt::IScheduler* s);
+    void enter0(Member& m);
+    void leave0(Member& m);
+    void cancel0();
+    bool ready0() const;
+    void wait0(bool any);
+    void reset0();
+
+    std::mutex mutex;
+    Member* members = nullptr;
     Handler proceed;
-    std::shared_ptr<Waiter> proceeder;
+    std::exception_ptr error;
+    size_t spawned = 0;
+    size_t active = 0;
+    size_t first = NONE;
+    bool cancelled = false;
+    bool any = false;
+};
+
+struct Waiter {
+    Waiter& go(Handler h);
+    void wait();
+
+private:
+    JourneyGroup group;
 };
 
 size_t goAnyWait(std::initializer_list<Handler> handlers);
@@ -114,15 +237,37 @@ private:
     const char* strandName;
 };
 
+// uses wheel<TimeoutTag>()
 struct TimeoutTag;
 struct Timeout {
     Timeout(int ms);
     ~Timeout();
 
 private:
-    boost::asio::deadline_timer timer;
+    WheelTimer timer;
 };
 
+const int64_t NO_DEADLINE = std::numeric_limits<int64_t>::max();
+
+// steady clock in nanoseconds
+int64_t nowNs();
+
+// Absolute deadline of the current journey: nested scopes only tighten
+// it and child journeys inherit it. The deadline is checked by
+// handleEvents and the single journey timer is armed for it
+// on the suspension (uses wheel<TimeoutTag>()), so the expired deadline
+// aborts the pending network operation with the timeout event.
+struct Deadline {
+    explicit Deadline(int ms);
+    ~Deadline();
+
+private:
+    int64_t prev;
+};
+
+// remaining time of the current journey deadline in ms, -1 if there is no deadline
+int64_t deadlineLeft();
+
 struct Service {
     Service() : service(nullptr) {}
 
@@ -140,6 +285,13 @@ Service& service() {
     return single<Service, T_tag>();
 }
 
+// timer wheel driven by service<T_tag>()
+template<typename T_tag>
+TimerWheel& wheel() {
+    static TimerWheel w(service<T_tag>());
+    return w;
+}
+
 struct Scheduler {
     Scheduler();
 
@@ -21,6 +21,7 @@
 #include <boost/coroutine/all.hpp>
 
 #include "common.h"
+#include "stack.h"
 
 namespace bc = boost::coroutines;
 typedef boost::coroutines::asymmetric_coroutine<Handler>::push_type PushCoroutine;
@@ -44,6 +45,9 @@ struct Coro {
     // create and start coroutine
     Coro(Handler);
 
+    // create coroutine with the specified stack size
+    explicit Coro(size_t stackSize);
+
     ~Coro();
 
     // start coroutine using handler
@@ -55,8 +59,13 @@ struct Coro {
     // is coroutine was started and not completed
     bool isStarted() const;
 
+    size_t stackSize() const;
+
+    // peak stack usage, available with flagSTACK_STATS only
+    size_t stackUsage() const;
+
 private:
-    void init0();
+    void init0(size_t size = STACK_SIZE);
     void yield0();
     void jump0(const Handler& p);
     void starter0(const Handler& p);
@@ -65,9 +74,11 @@ private:
     bool started;
     bool running;
 
-    PushCoroutine* coroutine;
+    PushCoroutine coroutine;
     PullCoroutine* savedCoroutine;
     std::exception_ptr exc;
+    size_t size;
+    Stack stack;
 };
 
 }
@@ -16,10 +16,10 @@
 
 #pragma once
 
-#include <vector>
 #include <boost/context/all.hpp>
 
 #include "common.h"
+#include "stack.h"
 
 namespace coro {
 
@@ -38,6 +38,9 @@ struct Coro
     
     // create and start coroutine
     Coro(Handler);
+
+    // create coroutine with the specified stack size
+    explicit Coro(size_t stackSize);
     
     ~Coro();
     
@@ -50,8 +53,13 @@ struct Coro
     // is coroutine was started and not completed
     bool isStarted() const;
 
+    size_t stackSize() const;
+
+    // peak stack usage, available with flagSTACK_STATS only
+    size_t stackUsage() const;
+
 private:
-    void init0();
+    void init0(size_t size = STACK_SIZE);
     void yield0();
     void jump0(intptr_t p = 0);
     static void starterWrapper0(intptr_t p);
@@ -62,7 +70,7 @@ private:
 
     boost::context::fcontext_t context;
     boost::context::fcontext_t savedContext;
-    std::vector<unsigned char> stack;
+    Stack stack;
     std::exception_ptr exc;
 };
 
@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <vector>
+#include <iterator>
+
 #include "mt.h"
 #include "channel.h"
 #include "helpers.h"
@@ -92,5 +95,86 @@ void piping1to01(T_src& s, T_dst& d, F_pipe f, int n = 1) {
     }, n);
 }
 
+// Batched variants: up to batch values are taken from the source
+// per wakeup and the results of the whole batch are put at once.
+// The output of piping1toManyBatch is collected by Batch sink.
+const size_t BATCH_SIZE = 64;
+
+template<typename T>
+struct Batch {
+    void put(T v) {
+        values.emplace_back(std::move(v));
+    }
+
+    std::vector<T> values;
+};
+
+template<typename T_dst, typename T>
+void putBatch(T_dst& d, std::vector<T>& values) {
+    if (values.empty())
+        return;
+    d.putMany(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+    values.clear();
+}
+
+template<typename T_src, typename T_dst, typename F_pipe>
+void piping1toManyBatch(T_src& s, T_dst& d, F_pipe f, int n = 1, size_t batch = BATCH_SIZE) {
+    piping(s, d, [f, batch] (T_src& s, T_dst& d) {
+        Batch<typename T_dst::value_type> out;
+        std::vector<typename T_src::value_type> in;
+        while (s.getMany(in, batch)) {
+            for (auto&& v: in) {
+                try {
+                    f(v, out);
+                } catch (std::exception& e) {
+                    RJLOG("Error: " << e.what());
+                }
+            }
+            in.clear();
+            putBatch(d, out.values);
+        }
+    }, n);
+}
+
+template<typename T_src, typename T_dst, typename F_pipe>
+void piping1to1Batch(T_src& s, T_dst& d, F_pipe f, int n = 1, size_t batch = BATCH_SIZE) {
+    piping(s, d, [f, batch] (T_src& s, T_dst& d) {
+        std::vector<typename T_dst::value_type> out;
+        std::vector<typename T_src::value_type> in;
+        while (s.getMany(in, batch)) {
+            for (auto&& v: in) {
+                try {
+                    out.emplace_back(f(v));
+                } catch (std::exception& e) {
+                    RJLOG("Error: " << e.what());
+                }
+            }
+            in.clear();
+            putBatch(d, out);
+        }
+    }, n);
+}
+
+template<typename T_src, typename T_dst, typename F_pipe>
+void piping1to01Batch(T_src& s, T_dst& d, F_pipe f, int n = 1, size_t batch = BATCH_SIZE) {
+    piping(s, d, [f, batch] (T_src& s, T_dst& d) {
+        std::vector<typename T_dst::value_type> out;
+        std::vector<typename T_src::value_type> in;
+        while (s.getMany(in, batch)) {
+            for (auto&& v: in) {
+                try {
+                    auto&& r = f(v);
+                    if (!isEmpty(r))
+                        out.emplace_back(std::move(r));
+                } catch (std::exception& e) {
+                    RJLOG("Error: " << e.what());
+                }
+            }
+            in.clear();
+            putBatch(d, out);
+        }
+    }, n);
+}
+
 }
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "network.h"
+#include "singleflight.h"
+
+namespace synca {
+namespace net {
+
+typedef std::vector<EndPoint> EndPointList;
+// resolves the hostname into the addresses (the port is ignored),
+// throws on failure
+typedef std::function<EndPointList(const std::string& host)> ResolveBackend;
+
+struct ResolverOptions {
+    int ttlMs = 60000;
+    // failed lookups are cached for the shorter time
+    int negativeTtlMs = 5000;
+};
+
+struct ResolverStats {
+    int64_t hits;
+    int64_t misses;         // the backend lookups
+    int64_t coalesced;      // resolves waited for the lookup in flight
+    int64_t failures;       // resolves failed including the cached failures
+};
+
+// Resolver caching the addresses and the failures. Concurrent resolves
+// of the same hostname run the single lookup, the other journeys are
+// suspended until its completion (see SingleFlight). The default
+// backend uses Resolver.
+struct CachingResolver {
+    explicit CachingResolver(const ResolverOptions& options = ResolverOptions(),
+        ResolveBackend backend = ResolveBackend());
+
+    CachingResolver(const CachingResolver&) = delete;
+    CachingResolver& operator=(const CachingResolver&) = delete;
+
+    // returns the non-empty list of the addresses with the port
+    EndPointList resolve(const std::string& host, int port);
+    ResolverStats stats() const;
+    void clear();
+
+private:
+    EndPointList lookup0(const std::string& host);
+
+    ResolveBackend backend;
+    SingleFlight<std::string, EndPointList> lookups;
+    std::atomic<int64_t> failures{0};
+};
+
+}
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+#include <boost/optional.hpp>
+
+#include "common.h"
+
+namespace synca {
+
+// scheduler of the blocking file operations if io_uring is not available
+struct FileTag;
+
+enum FileBackend {
+    FB_AUTO,    // io_uring if available, otherwise the blocking pool
+    FB_URING,
+    FB_POOL,    // blocking calls on the thread pool of scheduler<FileTag>()
+};
+
+// must be set before the file operations
+void setFileBackend(FileBackend backend);
+// the backend used by the file operations
+FileBackend fileBackend();
+
+// File with the asynchronous operations in synchronous manner: the journey
+// is suspended until the operation completion instead of blocking the thread.
+// The operations are submitted to io_uring or performed on the threads
+// of scheduler<FileTag>(). The operations are not aborted by the events:
+// the event received during the operation is thrown at the next suspension
+// of the journey after the operation result is applied.
+struct File {
+    enum Mode {
+        FM_READ = 1,
+        FM_WRITE = 2,
+        FM_CREATE = 4,
+        FM_TRUNCATE = 8,
+        // the initial position is the end of the file
+        FM_APPEND = 16,
+    };
+
+    File();
+    File(const std::string& path, int mode);
+    File(File&&);
+    ~File();
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    void open(const std::string& path, int mode);
+    void close();
+    bool isOpen() const;
+
+    // read and write use the file position, the buffer is resized
+    // to the read data size: the size is less at the end of the file
+    void read(Buffer& buffer);
+    void write(const Buffer& buffer);
+    void pread(Buffer& buffer, uint64_t offset);
+    void pwrite(const Buffer& buffer, uint64_t offset);
+    void pwrite(const char* data, size_t size, uint64_t offset);
+    void fsync();
+    uint64_t size() const;
+    uint64_t position() const;
+
+private:
+    int fd;
+    uint64_t pos;
+};
+
+// Log-structured key/value store: the records are appended to the file
+// and the index in memory maps the keys to the last records. The index
+// is restored by replaying the log on open, the torn record at the end
+// is discarded. The concurrent operations write the distinct regions
+// of the file. The replaced values occupy the file until it's removed.
+struct LogStore {
+    LogStore();
+
+    LogStore(const LogStore&) = delete;
+    LogStore& operator=(const LogStore&) = delete;
+
+    void open(const std::string& path);
+    bool isOpen() const;
+    boost::optional<std::string> get(const std::string& key);
+    void set(const std::string& key, const std::string& value);
+    // makes the written records durable
+    void sync();
+    size_t size() const;
+
+private:
+    struct Location {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    void replay0();
+
+    File file;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Location> index;
+    uint64_t end;
+};
+
+}
@@ -18,6 +18,10 @@
 
 #include <stdexcept>
 #include <memory>
+#include <atomic>
+#include <mutex>
+
+#include "common.h"
 
 namespace synca {
 
@@ -35,16 +39,28 @@ private:
     EventStatus st;
 };
 
+// Journey events state. The status is set by CAS from any thread:
+// only the first event is kept until it's handled by the journey.
+// The event aborts the operation the journey is suspended on.
 struct Goer {
     Goer();
     EventStatus reset();
     bool cancel();
     bool timedout();
 
+    // Starts the operation and registers the handler aborting it,
+    // the abort handler is invoked immediately if the event is already
+    // set. The start and the abort don't run concurrently.
+    void startAbortable(const Handler& start, Handler abort);
+    // must be called before the operation resources are destroyed
+    void resetAbort();
+
 private:
     struct State {
         State() : status(ES_NORMAL) {}
-        EventStatus status;
+        std::atomic<EventStatus> status;
+        std::mutex mutex;
+        Handler abort;
     };
 
     bool setStatus0(EventStatus s);
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "common.h"
+
+namespace synca {
+namespace io {
+
+// Fixed-size refcounted block drawn from the thread local pool. The block
+// is filled only by the chain owning it exclusively, the filled part
+// is immutable and shared by the slices.
+struct Block {
+    // the header fields are ordered without the padding
+    static const size_t SIZE = 4096 - sizeof(size_t) - sizeof(std::atomic<int>);
+
+    static Block* create();
+    static void acquire(Block* b);
+    static void release(Block* b);
+
+    size_t used;
+    std::atomic<int> refs;
+    char data[SIZE];
+};
+
+static_assert(sizeof(Block) == 4096, "Block must fit the page");
+
+// Refcounted view of the block part: copying doesn't copy the data.
+struct Slice {
+    Slice() = default;
+    Slice(Block* b, size_t offset, size_t size);
+    Slice(const Slice& s);
+    Slice(Slice&& s);
+    ~Slice();
+
+    Slice& operator=(Slice s);
+
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    Slice sub(size_t pos, size_t n) const;
+    Buffer str() const;
+
+private:
+    friend struct Chain;
+
+    Block* block = nullptr;
+    size_t off = 0;
+    size_t len = 0;
+};
+
+// writable area for the scatter read
+struct Region {
+    char* data;
+    size_t size;
+};
+
+// Chain of slices (iobuf): appending, splitting and sharing the data
+// between chains and channels don't copy the filled blocks.
+// The chain object itself is not thread safe.
+struct Chain {
+    static const size_t npos = size_t(-1);
+
+    Chain() = default;
+    explicit Chain(const Buffer& b);
+
+    void append(const char* data, size_t n);
+    void append(const Buffer& b);
+    void append(const Slice& s);
+    void append(const Chain& c);
+
+    // writable regions for at least n bytes: the free tail of the last
+    // exclusive block and new blocks, commit makes the first n bytes
+    // of the regions the chain data
+    void prepare(size_t n, std::vector<Region>& regions);
+    void commit(size_t n);
+
+    size_t size() const;
+    bool empty() const;
+    const std::deque<Slice>& slices() const;
+
+    // position of the pattern starting from pos or npos
+    size_t find(const Buffer& pattern, size_t pos = 0) const;
+    // cuts the first n bytes off the chain
+    Chain split(size_t n);
+    void skip(size_t n);
+    void clear();
+
+    // copies the first n bytes
+    Buffer str(size_t n = npos) const;
+
+private:
+    static bool writable0(const Slice& s);
+
+    std::deque<Slice> items;
+    size_t length = 0;
+    size_t prepared = 0;
+};
+
+}
+}
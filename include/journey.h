@@ -17,35 +17,48 @@
 #pragma once
 
 #include <stdexcept>
+#include <atomic>
 #include "coro.h"
 #include "mt.h"
 #include "goer.h"
 #include "core.h"
 #include "gc.h"
+#include "pool.h"
+#include "task.h"
 
 namespace synca {
 
-struct Journey {
+// journeys are allocated using the thread local pool
+struct Journey : Pooled<Journey> {
     ~Journey();
 
     void proceed();
     Handler proceedHandler();
     void defer(Handler handler);
     void deferProceed(ProceedHandler proceed);
+    void deferAbortable(ProceedHandler start, Handler abort);
     void teleport(mt::IScheduler& s);
 
     void handleEvents();
     void disableEvents();
     void enableEvents();
+    bool eventsEnabled() const;
+    // sets the events mode without handling the pending events,
+    // returns the previous mode
+    bool allowEvents(bool allowed);
+
+    // absolute deadline in steady clock nanoseconds
+    int64_t deadline() const;
+    void setDeadline(int64_t ns);
 
     mt::IScheduler& scheduler() const;
-    int index() const;
+    int64_t index() const;
     Goer goer() const;
 
-    static Goer create(Handler handler, mt::IScheduler& s);
+    static Goer create(Task handler, mt::IScheduler& s, size_t stackSize = coro::STACK_SIZE);
 
 private:
-    Journey(mt::IScheduler& s);
+    Journey(mt::IScheduler& s, size_t stackSize);
 
     struct CoroGuard {
         CoroGuard(Journey& j_) : j(j_)  {
@@ -62,22 +75,34 @@ private:
         Journey& j;
     };
 
-    Goer start0(Handler handler);
+    Goer start0(Task handler);
+    void run0();
     void schedule0(Handler handler);
+    void scheduleProceed0();
+    bool handoff0();
+    static void runNext0();
     CoroGuard guardedCoro0();
     void proceed0();
     void onEnter0();
     void onExit0();
+    void checkDeadline0();
+    void armDeadline0();
 
     Goer gr;
     bool eventsAllowed;
     mt::IScheduler* sched;
     coro::Coro coro;
+    Task task;
     Handler deferHandler;
-    int indx;
+    int64_t indx;
+    std::atomic<int64_t> deadlineNs;
+    int64_t armedNs;
 
     friend GC& ::gc();
     GC gc;
+
+    // destroyed first: the handler uses the journey
+    WheelTimer deadlineTimer;
 };
 
 Journey& journey();
@@ -16,10 +16,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include <boost/asio.hpp>
 
 #include "common.h"
 #include "mt.h"
+#include "iobuf.h"
 
 namespace synca {
 
@@ -33,36 +38,158 @@ typedef boost::asio::ip::tcp::resolver::iterator EndPoints;
 
 struct Acceptor;
 
+// write statistics of the socket
+struct WriteStats {
+    int64_t writes;     // write calls
+    int64_t sends;      // socket write operations
+    int64_t bytes;      // bytes sent
+};
+
 
 // Обертка над сокетом
+// The cancel or timeout of the journey aborts its pending operation by
+// cancelling all pending operations of the socket: while the events are
+// enabled the socket must be used by a single journey, otherwise the event
+// of one journey fails the operations of the others with operation_aborted.
 struct Socket {
     friend struct Acceptor;
+    friend struct Cork;
 
     Socket();
     Socket(Socket&&);
+    ~Socket();
     boost::asio::ip::tcp::socket& getSocket();
     void read(Buffer&);
     void partialRead(Buffer&);
+    // reads into the fixed-size buffer until the delimiter is received,
+    // the data after the delimiter stays in the buffer: see StreamReader
     void readUntil(Buffer& buffer, const Buffer& stopValue);
+    // The writes issued while the previous write is in flight or while
+    // the socket is corked are queued and sent by a single gather operation.
+    // The writer is suspended until its queued data is sent, so the queue
+    // is bounded by the number of the writers and the send error is raised
+    // in each writer. The write to the corked socket returns immediately.
     void write(const Buffer&);
+    // sends the queued data or waits for the send in flight,
+    // raises the error of the send performed by Cork
+    void flush();
+    // the writes are queued until the matching uncork
+    void cork();
+    void uncork();
+    WriteStats writeStats() const;
+    // scatter/gather operations: the data is read into the pooled
+    // blocks appended to the chain without copying
+    void read(io::Chain& chain, size_t n);
+    size_t partialRead(io::Chain& chain, size_t maxN = io::Block::SIZE);
+    void write(const io::Chain& chain);
     void connect(const std::string& ip, int port);
     void connect(const EndPoint& e);
     void close();
 
 private:
+    struct Output;
+
+    template<typename T_data>
+    void write0(const T_data& data);
+    void send0(const Buffer& buffer);
+    void send0(const io::Chain& chain);
+    void flush0();
+    // returns true if the socket is uncorked
+    bool uncork0();
+
     boost::asio::ip::tcp::socket _socket;
+    std::unique_ptr<Output> _output;
+};
+
+// Corks the socket in the scope, the queued data is sent on exit
+// unless the scope is left by the exception. The destructor doesn't
+// throw: the send error is raised by the next flush.
+struct Cork {
+    explicit Cork(Socket& s);
+    ~Cork();
+
+private:
+    Socket& socket;
+};
+
+// Buffered reader over the socket: the data read ahead is kept in the chain
+// and served by the subsequent calls without the socket operations.
+// The delimiters are searched only in the newly received data.
+struct StreamReader {
+    static const size_t DEFAULT_LIMIT = 64 * 1024;
+
+    explicit StreamReader(Socket& s);
+
+    // the line without the line ending ("\n" or "\r\n")
+    Buffer readLine(size_t limit = DEFAULT_LIMIT);
+    // the data including the delimiter, raises if the delimiter is not
+    // found within the limit
+    Buffer readUntil(const Buffer& delim, size_t limit = DEFAULT_LIMIT);
+    Buffer readExactly(size_t n);
+    void readExactly(io::Chain& chain, size_t n);
+    // the first n bytes without consuming them
+    Buffer peek(size_t n);
+    size_t buffered() const;
+
+private:
+    size_t find0(const Buffer& delim, size_t limit);
+    void fill0(size_t n);
+
+    Socket& socket;
+    io::Chain buffer;
+};
+
+struct AcceptorOptions {
+    int backlog = boost::asio::socket_base::max_connections;
+    bool reuseAddress = true;
+    // the port may be shared by several acceptors, see MultiAcceptor
+    bool reusePort = false;
+    // max connections taken per wakeup, the pending connections
+    // after the first one are taken without waiting
+    size_t batch = 1;
+    // options of the accepted sockets, 0 keeps the system buffer size
+    bool noDelay = false;
+    bool keepAlive = false;
+    int receiveBuffer = 0;
+    int sendBuffer = 0;
 };
 
 // Обертка над приемщиком соединений
 typedef std::function<void(const std::weak_ptr<Socket>&)> SocketHandler;
 struct Acceptor {
     explicit Acceptor(int port);
+    Acceptor(int port, const AcceptorOptions& options);
 
     Socket accept();
+    // waits for the connection and takes up to batch connections
+    std::vector<Socket> acceptBatch();
+    // the sockets are handled by the new journeys on the scheduler
+    // of the current journey
     void goAccept(SocketHandler);
+    void close();
 
 private:
+    void configure0(Socket& socket);
+
     boost::asio::ip::tcp::acceptor _acceptor;
+    AcceptorOptions _options;
+};
+
+// Acceptors sharing the port using SO_REUSEPORT, one per scheduler.
+// The kernel balances the connections between the acceptors and
+// the accepted sockets are handled on the scheduler of the acceptor.
+struct MultiAcceptor {
+    MultiAcceptor(int port, const std::vector<mt::IScheduler*>& schedulers,
+        AcceptorOptions options = AcceptorOptions());
+
+    // runs the accept loops until close
+    void serve(SocketHandler handler);
+    void close();
+
+private:
+    std::vector<std::unique_ptr<Acceptor>> _acceptors;
+    std::vector<mt::IScheduler*> _schedulers;
+    std::atomic<bool> _closed;
 };
 
 // Резолвер
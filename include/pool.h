@@ -0,0 +1,143 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "helpers.h"
+
+struct PoolNode {
+    PoolNode* next;
+};
+
+struct PoolFlusher {
+    void (*flush)();
+    PoolFlusher* next;
+};
+
+// registers thread local pool to be flushed on the thread exit
+void registerPoolFlusher(PoolFlusher& flusher);
+
+// returns cached blocks of the current thread to the system
+void flushPools();
+
+// Thread local free list of the blocks for T objects. Block may be released
+// on any thread and goes to the list of that thread. Blocks above the limit
+// are returned to the system.
+template<typename T, size_t N_limit = 1024>
+struct BlockPool {
+    static void* allocate() {
+        PoolNode* node = t_root;
+        if (node == nullptr)
+            return ::operator new(size0());
+        t_root = node->next;
+        -- t_count;
+        return node;
+    }
+
+    static void deallocate(void* p) {
+        if (t_count >= N_limit) {
+            ::operator delete(p);
+            return;
+        }
+        if (t_flusher.flush == nullptr) {
+            t_flusher.flush = &flush;
+            registerPoolFlusher(t_flusher);
+        }
+        PoolNode* node = static_cast<PoolNode*>(p);
+        node->next = t_root;
+        t_root = node;
+        ++ t_count;
+    }
+
+    static void flush() {
+        while (t_root != nullptr) {
+            PoolNode* node = t_root;
+            t_root = node->next;
+            ::operator delete(node);
+        }
+        t_count = 0;
+    }
+
+private:
+    static size_t size0() {
+        return sizeof(T) < sizeof(PoolNode) ? sizeof(PoolNode) : sizeof(T);
+    }
+
+    static TLS PoolNode* t_root;
+    static TLS size_t t_count;
+    static TLS PoolFlusher t_flusher;
+};
+
+template<typename T, size_t N_limit>
+TLS PoolNode* BlockPool<T, N_limit>::t_root = nullptr;
+
+template<typename T, size_t N_limit>
+TLS size_t BlockPool<T, N_limit>::t_count = 0;
+
+template<typename T, size_t N_limit>
+TLS PoolFlusher BlockPool<T, N_limit>::t_flusher = {nullptr, nullptr};
+
+// base class to allocate objects using the pool
+template<typename T>
+struct Pooled {
+    static void* operator new(size_t size) {
+        return size == sizeof(T) ? BlockPool<T>::allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void* p, size_t size) {
+        if (size == sizeof(T))
+            BlockPool<T>::deallocate(p);
+        else
+            ::operator delete(p);
+    }
+};
+
+// allocator to use the pool for std::allocate_shared and containers nodes
+template<typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 1)
+            return static_cast<T*>(BlockPool<T>::allocate());
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n == 1)
+            BlockPool<T>::deallocate(p);
+        else
+            ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const {
+        return false;
+    }
+};
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <iterator>
+
+#include "core.h"
+#include "helpers.h"
+
+namespace synca {
+
+// Lock-free channel with the same API as Channel: bounded MPMC ring buffer
+// (Vyukov sequence numbers) and lock-free stacks of the suspended
+// receivers and senders. The journey is suspended only when the ring is
+// empty (get) or full (put), woken journey retries the operation.
+// Capacity is rounded up to the power of 2.
+template<typename T>
+struct RingChannel {
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    struct Waiter {
+        Handler proc;
+        Waiter* next = nullptr;
+    };
+
+    typedef std::atomic<Waiter*> Waiters;
+    typedef bool (RingChannel::*Ready)() const;
+
+public:
+    typedef T value_type;
+
+    static const size_t DEFAULT_CAPACITY = 1024;
+
+    struct Iterator {
+        Iterator() = default;
+        Iterator(RingChannel& c) : ch(&c)        {
+            ++*this;
+        }
+
+        T& operator*()                           {
+            return val;
+        }
+        Iterator& operator++()                   {
+            if (!ch->get(val)) ch = nullptr;
+            return *this;
+        }
+        bool operator!=(const Iterator& i) const {
+            return ch != i.ch;
+        }
+    private:
+        T val;
+        RingChannel* ch = nullptr;
+    };
+
+    explicit RingChannel(size_t capacity = DEFAULT_CAPACITY) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++ i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    RingChannel(const RingChannel&) = delete;
+    RingChannel& operator=(const RingChannel&) = delete;
+
+    Iterator begin()                             {
+        return {*this};
+    }
+    static Iterator end()                        {
+        return {};
+    }
+
+    // returns false if the channel is closed, the value is dropped,
+    // suspends the journey while the ring is full
+    bool put(T val) {
+        while (true) {
+            if (closed.load())
+                return false;
+            if (tryPush0(val)) {
+                notify0(receivers, &RingChannel::readable0);
+                return true;
+            }
+            wait0(senders, &RingChannel::writable0);
+        }
+    }
+
+    bool get(T& val) {
+        while (true) {
+            // values put before closing are still delivered
+            bool isClosed = closed.load();
+            if (tryPop0(val)) {
+                notify0(senders, &RingChannel::writable0);
+                return true;
+            }
+            if (isClosed)
+                return false;
+            wait0(receivers, &RingChannel::readable0);
+        }
+    }
+
+    template<typename T_it>
+    bool putMany(T_it first, T_it last) {
+        for (; first != last; ++ first)
+            if (!put(*first))
+                return false;
+        return true;
+    }
+
+    template<typename T_range>
+    bool putMany(T_range&& values) {
+        return putMany(std::begin(values), std::end(values));
+    }
+
+    // waits for the first value and takes up to maxN available values
+    size_t getMany(std::vector<T>& out, size_t maxN) {
+        VERIFY(maxN > 0, "Batch size must be positive");
+        T val;
+        if (!get(val))
+            return 0;
+        out.emplace_back(std::move(val));
+        size_t n = 1;
+        for (; n < maxN && tryPop0(val); ++ n)
+            out.emplace_back(std::move(val));
+        if (n > 1)
+            notify0(senders, &RingChannel::writable0);
+        return n;
+    }
+
+    T get() {
+        T val;
+        get(val);
+        return val;
+    }
+
+    bool empty() const {
+        return !readable0();
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    void open() {
+        closed = false;
+    }
+
+    void close() {
+        if (closed.exchange(true))
+            return;
+        wakeAll0(receivers);
+        wakeAll0(senders);
+    }
+
+private:
+    bool tryPush0(T& val) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(val);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop0(T& val) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+            if (dif == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        val = std::move(cell->value);
+        cell->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool readable0() const {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        return cells[pos & mask].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    bool writable0() const {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        return cells[pos & mask].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    // Suspends the journey: the waiter is published after the suspension
+    // and then the condition is checked again. Together with the check
+    // in notify0 either the waker sees the waiter or the waiter sees
+    // the changed ring.
+    void wait0(Waiters& ws, Ready ready) {
+        Waiter w;
+        deferProceed([this, &w, &ws, ready](Handler proceed) {
+            w.proc = std::move(proceed);
+            push0(ws, &w, &w);
+            // the waiter may be already resumed and destroyed here
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (closed.load())
+                wakeAll0(ws);
+            else if ((this->*ready)())
+                notify0(ws, ready);
+        });
+    }
+
+    // Wakes up one waiter. The whole stack is taken at once to avoid ABA
+    // and the rest is pushed back. While the rest is detached other wakers
+    // may miss it, so the condition is checked again after returning it.
+    void notify0(Waiters& ws, Ready ready) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (ws.load(std::memory_order_relaxed) != nullptr) {
+            Waiter* w = ws.exchange(nullptr);
+            if (w == nullptr)
+                return;
+            Waiter* rest = w->next;
+            if (rest != nullptr) {
+                Waiter* last = rest;
+                while (last->next != nullptr)
+                    last = last->next;
+                push0(ws, rest, last);
+            }
+            wake0(w);
+            if (rest == nullptr)
+                return;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!(this->*ready)())
+                return;
+        }
+    }
+
+    void wakeAll0(Waiters& ws) {
+        Waiter* w = ws.exchange(nullptr);
+        while (w != nullptr) {
+            Waiter* next = w->next;
+            wake0(w);
+            w = next;
+        }
+    }
+
+    // the waiter is destroyed by the resumed journey
+    static void wake0(Waiter* w) {
+        Handler proc = std::move(w->proc);
+        proc();
+    }
+
+    static void push0(Waiters& ws, Waiter* first, Waiter* last) {
+        Waiter* head = ws.load(std::memory_order_relaxed);
+        do {
+            last->next = head;
+        } while (!ws.compare_exchange_weak(head, first));
+    }
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    char padCells[64];
+    std::atomic<size_t> enqueuePos;
+    char padEnqueue[64];
+    std::atomic<size_t> dequeuePos;
+    char padDequeue[64];
+    Waiters receivers{nullptr};
+    Waiters senders{nullptr};
+    std::atomic<bool> closed{false};
+};
+
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+#include "channel.h"
+
+namespace synca {
+
+// select case over the channel, all calls except complete
+// are made under the channel lock
+struct ISelectCase : IObject {
+    virtual std::mutex& mutex() = 0;
+    // performs the operation if the channel is ready or closed
+    virtual bool tryFire(bool& ok) = 0;
+    virtual void enlist(std::atomic<int>& selected, int index, Handler proceed) = 0;
+    // locks the channel itself
+    virtual void delist() = 0;
+    // completes the counterparts woken by tryFire after the unlock
+    virtual void complete() = 0;
+    virtual bool completed() const = 0;
+};
+
+template<typename T>
+struct SelectGet : ISelectCase {
+    SelectGet(Channel<T>& c, T& v) : ch(c), val(v), waiter(v) {}
+
+    std::mutex& mutex() {
+        return ch.mutex;
+    }
+
+    bool tryFire(bool& ok) {
+        ok = ch.take0(val, woken);
+        return ok || ch.closed;
+    }
+
+    void enlist(std::atomic<int>& selected, int index, Handler proceed) {
+        waiter.setSelect(selected, index, std::move(proceed));
+        ch.receivers.push(waiter);
+        enlisted = true;
+    }
+
+    void delist() {
+        if (!enlisted)
+            return;
+        std::lock_guard<std::mutex> lock(ch.mutex);
+        ch.receivers.remove(waiter);
+    }
+
+    void complete() {
+        Channel<T>::complete0(woken);
+    }
+
+    bool completed() const {
+        return waiter.completed();
+    }
+
+private:
+    Channel<T>& ch;
+    T& val;
+    typename Channel<T>::Waiter waiter;
+    typename Channel<T>::Waiters woken;
+    bool enlisted = false;
+};
+
+template<typename T>
+struct SelectPut : ISelectCase {
+    SelectPut(Channel<T>& c, T&& v) : ch(c), val(std::move(v)), waiter(val) {}
+
+    std::mutex& mutex() {
+        return ch.mutex;
+    }
+
+    bool tryFire(bool& ok) {
+        ok = !ch.closed && ch.give0(val, woken);
+        return ok || ch.closed;
+    }
+
+    void enlist(std::atomic<int>& selected, int index, Handler proceed) {
+        waiter.setSelect(selected, index, std::move(proceed));
+        ch.senders.push(waiter);
+        enlisted = true;
+    }
+
+    void delist() {
+        if (!enlisted)
+            return;
+        std::lock_guard<std::mutex> lock(ch.mutex);
+        ch.senders.remove(waiter);
+    }
+
+    void complete() {
+        Channel<T>::complete0(woken);
+    }
+
+    bool completed() const {
+        return waiter.completed();
+    }
+
+private:
+    Channel<T>& ch;
+    T val;
+    typename Channel<T>::Waiter waiter;
+    typename Channel<T>::Waiters woken;
+    bool enlisted = false;
+};
+
+// Waits for the first ready case among get and put operations on several
+// channels, e.g.:
+//     int v;
+//     size_t i = Select().get(c1, v).put(c2, 5).timeout(100).wait();
+// Cases are checked in the order of addition. Only one waiter per case is
+// registered in the channel and the waiters of the losing cases are
+// removed. The case on the closed channel fires with ok() == false.
+// Select object is intended for the single wait.
+struct Select {
+    // no ready case on tryWait
+    static const size_t NONE = size_t(-1);
+    // timeout fired
+    static const size_t TIMEDOUT = size_t(-2);
+
+    Select();
+    ~Select();
+
+    template<typename T>
+    Select& get(Channel<T>& c, T& val) {
+        cases.emplace_back(new SelectGet<T>(c, val));
+        return *this;
+    }
+
+    template<typename T>
+    Select& put(Channel<T>& c, T val) {
+        cases.emplace_back(new SelectPut<T>(c, std::move(val)));
+        return *this;
+    }
+
+    // uses wheel<TimeoutTag>
+    Select& timeout(int ms);
+
+    // returns the index of the fired case or TIMEDOUT
+    size_t wait();
+    // default case: returns the index of the ready case or NONE
+    size_t tryWait();
+    // false if the fired case channel is closed
+    bool ok() const;
+
+private:
+    struct State;
+    struct Timer;
+
+    void enlist0();
+    void finish0();
+    void startTimer0();
+
+    std::vector<std::unique_ptr<ISelectCase>> cases;
+    std::shared_ptr<State> state;
+    std::unique_ptr<Timer> timer;
+    int timeoutMs;
+    bool fired;
+    bool okValue;
+};
+
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+
+#include "core.h"
+
+namespace synca {
+
+struct SingleFlightStats {
+    int64_t loads;      // loader calls
+    int64_t shared;     // calls waited for the loader in flight
+    int64_t memoized;   // calls returned the memoized result or error
+};
+
+// Request coalescing: concurrent calls with the same key run the single
+// loader, the other journeys are suspended until its completion and get
+// the same result or the same error including the timeout or the
+// cancellation of the loading journey. The successful result may be
+// memoized for the short time, the errors for their own time except
+// the events of the loading journey. The expired entries are swept
+// as the map grows. The wait is interrupted by the events of the waiter.
+template<typename T_key, typename T_value, typename T_hash = std::hash<T_key>>
+struct SingleFlight {
+    explicit SingleFlight(int memoizeMs = 0, int memoizeErrorMs = 0) :
+        memoMs(memoizeMs),
+        errorMemoMs(memoizeErrorMs) {}
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+
+    template<typename F>
+    T_value get(const T_key& key, F&& loader) {
+        {
+            Lock lock(mutex);
+            int64_t now = nowNs();
+            auto it = calls.find(key);
+            if (it != calls.end()) {
+                Call& c = it->second;
+                if (c.inFlight)
+                    return wait0(key, c, lock);
+                if (c.expiresNs > now) {
+                    ++ memoized;
+                    if (c.error)
+                        std::rethrow_exception(c.error);
+                    return *c.result;
+                }
+            } else if (calls.size() >= sweepAt) {
+                sweep0(now);
+            }
+            calls[key] = Call();
+            ++ loads;
+        }
+        Result result;
+        std::exception_ptr error;
+        int ttlMs = memoMs;
+        try {
+            result = std::make_shared<T_value>(loader());
+        } catch (EventException&) {
+            error = std::current_exception();
+            ttlMs = 0;
+        } catch (...) {
+            error = std::current_exception();
+            ttlMs = errorMemoMs;
+        }
+        complete0(key, result, error, ttlMs);
+        if (error)
+            std::rethrow_exception(error);
+        return *result;
+    }
+
+    // drops the memoized result
+    void forget(const T_key& key) {
+        Lock lock(mutex);
+        auto it = calls.find(key);
+        if (it != calls.end() && !it->second.inFlight)
+            calls.erase(it);
+    }
+
+    // drops the memoized results, the loaders in flight are kept
+    void clear() {
+        Lock lock(mutex);
+        sweep0(INT64_MAX);
+    }
+
+    SingleFlightStats stats() const {
+        return {loads.load(), shared.load(), memoized.load()};
+    }
+
+private:
+    typedef std::unique_lock<std::mutex> Lock;
+    typedef std::shared_ptr<const T_value> Result;
+
+    static const size_t MIN_SWEEP = 64;
+
+    struct Waiter {
+        Handler proceed;
+        Result result;
+        std::exception_ptr error;
+        Waiter* next = nullptr;
+    };
+
+    struct Call {
+        bool inFlight = true;
+        Result result;
+        std::exception_ptr error;
+        int64_t expiresNs = 0;
+        Waiter* waiters = nullptr;
+    };
+
+    T_value wait0(const T_key& key, Call& c, Lock& lock) {
+        Waiter w;
+        w.next = c.waiters;
+        c.waiters = &w;
+        ++ shared;
+        lock.release();
+        deferAbortable([this, &w](Handler proceed) {
+            w.proceed = std::move(proceed);
+            mutex.unlock();
+        }, [this, &key, &w] {
+            abort0(key, w);
+        });
+        if (w.error)
+            std::rethrow_exception(w.error);
+        return *w.result;
+    }
+
+    // the waiter interrupted by the event leaves the call
+    void abort0(const T_key& key, Waiter& w) {
+        {
+            Lock lock(mutex);
+            auto it = calls.find(key);
+            if (it == calls.end())
+                return;
+            Waiter** p = &it->second.waiters;
+            while (*p && *p != &w)
+                p = &(*p)->next;
+            if (*p == nullptr)
+                return;
+            *p = w.next;
+        }
+        w.proceed();
+    }
+
+    void complete0(const T_key& key, const Result& result,
+            const std::exception_ptr& error, int ttlMs) {
+        Waiter* w;
+        {
+            Lock lock(mutex);
+            auto it = calls.find(key);
+            Call& c = it->second;
+            w = c.waiters;
+            if (ttlMs > 0) {
+                c.inFlight = false;
+                c.result = result;
+                c.error = error;
+                c.expiresNs = nowNs() + int64_t(ttlMs) * 1000000;
+                c.waiters = nullptr;
+            } else {
+                calls.erase(it);
+            }
+        }
+        while (w) {
+            // the waiter is destroyed after the resumption
+            Waiter* next = w->next;
+            w->result = result;
+            w->error = error;
+            w->proceed();
+            w = next;
+        }
+    }
+
+    // erases the entries expired before the time, the next sweep
+    // is performed when the map doubles
+    void sweep0(int64_t now) {
+        for (auto it = calls.begin(); it != calls.end();) {
+            if (!it->second.inFlight && it->second.expiresNs <= now)
+                it = calls.erase(it);
+            else
+                ++ it;
+        }
+        sweepAt = std::max(size_t(MIN_SWEEP), 2 * calls.size());
+    }
+
+    int memoMs;
+    int errorMemoMs;
+    std::mutex mutex;
+    std::unordered_map<T_key, Call, T_hash> calls;
+    size_t sweepAt = MIN_SWEEP;
+    std::atomic<int64_t> loads{0};
+    std::atomic<int64_t> shared{0};
+    std::atomic<int64_t> memoized{0};
+};
+
+}
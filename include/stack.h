@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+
+namespace coro {
+
+#ifdef flagMMAP_STACK
+// reserved address space: pages are committed on the first touch
+const size_t STACK_SIZE = 1024*256;
+#else
+const size_t STACK_SIZE = 1024*32;
+#endif
+
+// stack sizes are rounded up to the power of 2 within the range
+const size_t STACK_MIN_SIZE = 1024*4;
+const size_t STACK_CLASSES = 12;
+
+// coroutine stack memory: [ptr, ptr + size)
+struct Stack {
+    Stack() : ptr(nullptr), size(0) {}
+
+    // stack grows down, so the context starts from the top
+    void* top() const {
+        return static_cast<char*>(ptr) + size;
+    }
+
+    void* ptr;
+    size_t size;
+};
+
+// fills the stack by the pattern to measure the usage later
+void paint(Stack& stack);
+// peak usage of the painted stack
+size_t usage(const Stack& stack);
+
+struct StackNode;
+
+// Stacks cache: thread local free lists with the global overflow pool
+// for each size class.
+// Released stacks go to the current thread list. When the list reaches
+// high watermark it is trimmed down to low watermark into the global pool,
+// empty list is refilled from the global pool up to low watermark.
+// Stacks above the global pool capacity are returned to the system.
+// Stack memory is never initialized on reuse.
+// With flagMMAP_STACK the stack is mapped with the guard page below it,
+// stacks moved to the global pool release their resident pages.
+struct StackPool {
+    StackPool();
+    ~StackPool();
+
+    Stack allocate(size_t size = STACK_SIZE);
+    void deallocate(Stack& stack);
+
+    // moves stacks of the current thread to the global pool,
+    // must be called before the thread exit
+    void flush();
+
+    // limits are applied to each size class
+    void setCapacity(size_t capacity);
+    void setWatermarks(size_t low, size_t high);
+
+    // allocations served from the pool
+    size_t hits() const;
+    // allocations served from the system
+    size_t misses() const;
+    // stacks in the global pool of all classes
+    size_t cached() const;
+
+private:
+    void refill0(size_t cls);
+    void trim0(size_t cls);
+    void put0(size_t cls, StackNode* list);
+    void release0(StackNode* list);
+
+    mutable std::mutex mutex;
+    StackNode* roots[STACK_CLASSES];
+    size_t counts[STACK_CLASSES];
+    size_t capacity;
+    size_t lowWatermark;
+    size_t highWatermark;
+    std::atomic<size_t> hitCount;
+    std::atomic<size_t> missCount;
+};
+
+StackPool& stackPool();
+
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "mt.h"
+
+namespace mt {
+
+struct Job;
+
+// Chase-Lev work stealing deque: the owner pushes and takes from the bottom,
+// thieves steal from the top
+struct WorkDeque {
+    WorkDeque();
+    ~WorkDeque();
+
+    // owner only
+    void push(Job* job);
+    Job* take();
+
+    // any thread
+    Job* steal();
+    bool empty() const;
+
+private:
+    struct Array;
+
+    Array* grow0(Array* a, int64_t top, int64_t bottom);
+
+    std::atomic<int64_t> top;
+    char padTop[64];
+    std::atomic<int64_t> bottom;
+    std::atomic<Array*> array;
+    std::vector<Array*> retired;
+    char padBottom[64];
+};
+
+// Thread pool with per worker deques: handlers scheduled from the worker
+// go to its deque (LIFO for the owner), idle workers steal from the others
+// (FIFO). Handlers from other threads go to the shared injection queue.
+// Idle worker spins for a while and then parks inside the io service
+// waiting for the network completions or for the wake up.
+struct WorkStealingPool : IScheduler, IService {
+    WorkStealingPool(size_t threadCount, const char* name = "");
+    ~WorkStealingPool();
+
+    void schedule(Handler handler);
+    // blocks until all scheduled handlers complete,
+    // pending io operations are not awaited
+    void wait();
+    const char* name() const;
+
+private:
+    struct Worker;
+
+    IoService& ioService();
+
+    void run0(Worker& w);
+    Job* find0(Worker& w);
+    Job* steal0(Worker& w);
+    Job* spin0(Worker& w);
+    Job* takeInjected0();
+    bool hasJobs0() const;
+    void park0();
+    void wake0();
+    void execute0(Job* job);
+
+    const char* _tpName;
+    IoService _service;
+    std::unique_ptr<Work> _work;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    std::mutex _injectMutex;
+    std::deque<Job*> _injected;
+    std::atomic<size_t> _injectedCount;
+
+    std::atomic<size_t> _spinning;
+    std::atomic<size_t> _sleepers;
+    std::atomic<size_t> _waiters;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::atomic<bool> _toStop;
+};
+
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// Move-only handler: callables up to STORAGE_SIZE bytes are kept inline
+// without heap allocation, larger ones are allocated on the heap
+struct Task {
+    static const size_t STORAGE_SIZE = 64;
+
+    Task() : ops(nullptr) {}
+    Task(std::nullptr_t) : ops(nullptr) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        typedef typename std::conditional<isInline0<Fn>(), InlineOps<Fn>, HeapOps<Fn>>::type Ops;
+        Ops::create(&storage, std::forward<F>(f));
+        ops = &Ops::table;
+    }
+
+    Task(Task&& t) : ops(t.ops) {
+        if (ops)
+            ops->move(&t.storage, &storage);
+        t.ops = nullptr;
+    }
+
+    Task& operator=(Task&& t) {
+        if (this != &t) {
+            reset();
+            ops = t.ops;
+            if (ops)
+                ops->move(&t.storage, &storage);
+            t.ops = nullptr;
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        ops->invoke(&storage);
+    }
+
+    explicit operator bool() const {
+        return ops != nullptr;
+    }
+
+    void reset() {
+        if (ops)
+            ops->destroy(&storage);
+        ops = nullptr;
+    }
+
+private:
+    typedef typename std::aligned_storage<STORAGE_SIZE>::type Storage;
+
+    struct Ops {
+        void (*invoke)(void*);
+        // moves to the destination and destroys the source
+        void (*move)(void* from, void* to);
+        void (*destroy)(void*);
+    };
+
+    template<typename F>
+    static constexpr bool isInline0() {
+        return sizeof(F) <= sizeof(Storage)
+            && std::alignment_of<Storage>::value % std::alignment_of<F>::value == 0
+            && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template<typename F>
+    struct InlineOps {
+        template<typename T>
+        static void create(void* s, T&& t) {
+            new (s) F(std::forward<T>(t));
+        }
+
+        static void invoke(void* s) {
+            (*static_cast<F*>(s))();
+        }
+
+        static void move(void* from, void* to) {
+            new (to) F(std::move(*static_cast<F*>(from)));
+            destroy(from);
+        }
+
+        static void destroy(void* s) {
+            static_cast<F*>(s)->~F();
+        }
+
+        static const Ops table;
+    };
+
+    template<typename F>
+    struct HeapOps {
+        template<typename T>
+        static void create(void* s, T&& t) {
+            *static_cast<F**>(s) = new F(std::forward<T>(t));
+        }
+
+        static void invoke(void* s) {
+            (**static_cast<F**>(s))();
+        }
+
+        static void move(void* from, void* to) {
+            *static_cast<F**>(to) = *static_cast<F**>(from);
+        }
+
+        static void destroy(void* s) {
+            delete *static_cast<F**>(s);
+        }
+
+        static const Ops table;
+    };
+
+    Storage storage;
+    const Ops* ops;
+};
+
+template<typename F>
+const Task::Ops Task::InlineOps<F>::table = {
+    &Task::InlineOps<F>::invoke,
+    &Task::InlineOps<F>::move,
+    &Task::InlineOps<F>::destroy
+};
+
+template<typename F>
+const Task::Ops Task::HeapOps<F>::table = {
+    &Task::HeapOps<F>::invoke,
+    &Task::HeapOps<F>::move,
+    &Task::HeapOps<F>::destroy
+};
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "mt.h"
+#include "task.h"
+
+namespace synca {
+
+struct Service;
+struct WheelTimer;
+
+// Hashed timer wheels. Each thread arms the timers in its own wheel
+// (see counterSlot), so arm and cancel are O(1) under the uncontended
+// wheel lock. The single ticker on the attached service advances all
+// wheels every tick while there are armed timers and invokes expired
+// handlers on the service thread. Timeouts are rounded up to the tick
+// and fire within the next tick, never earlier than requested.
+struct TimerWheel {
+    static const int DEFAULT_TICK_MS = 10;
+    static const size_t BUCKETS = 256;
+
+    explicit TimerWheel(Service& s);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // tick granularity, must be set before arming the timers
+    void setTick(int ms);
+    int tick() const;
+
+private:
+    friend struct WheelTimer;
+
+    struct Wheel;
+    struct Ticker;
+
+    void arm0(WheelTimer& t, int ms);
+    bool cancel0(WheelTimer& t);
+    void startTicker0();
+    // returns true if there are armed timers
+    bool advance0();
+    void fire0(Wheel& w);
+    bool armed0() const;
+
+    Service& service;
+    std::unique_ptr<Wheel[]> wheels;
+    std::atomic<bool> ticking;
+    int tickMs;
+};
+
+// The timer in the wheel, may be restarted after firing or cancelling.
+// The handler is invoked on the thread of the wheel service.
+struct WheelTimer {
+    WheelTimer();
+    ~WheelTimer();
+
+    WheelTimer(const WheelTimer&) = delete;
+    WheelTimer& operator=(const WheelTimer&) = delete;
+
+    void start(TimerWheel& w, int ms, Task handler);
+    // returns false if the handler is already invoked,
+    // waits for the handler running concurrently unless
+    // it's called by the handler of the timer itself
+    bool cancel();
+
+private:
+    friend struct TimerWheel;
+
+    enum State {
+        TS_IDLE,
+        TS_ARMED,
+        // unlinked by the tick, the handler is not invoked yet
+        TS_EXPIRED,
+        TS_FIRING,
+    };
+
+    Task handler;
+    TimerWheel* owner = nullptr;
+    TimerWheel::Wheel* wheel = nullptr;
+    WheelTimer* prev = nullptr;
+    WheelTimer* next = nullptr;
+    size_t bucket = 0;
+    size_t rounds = 0;
+    std::atomic<int> state;
+};
+
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mutex>
+#include <deque>
+#include <exception>
+#include <unordered_map>
+
+#include "connpool.h"
+#include "dnscache.h"
+#include "core.h"
+#include "helpers.h"
+
+namespace synca {
+namespace net {
+
+typedef boost::system::error_code Error;
+
+namespace {
+
+// the idle connection must have neither the data nor the end of stream
+bool alive(Socket& socket) {
+    boost::asio::ip::tcp::socket& s = socket.getSocket();
+    if (!s.is_open())
+        return false;
+    char c;
+    Error error;
+    s.non_blocking(true, error);
+    if (!!error)
+        return false;
+    s.receive(boost::asio::buffer(&c, 1), boost::asio::socket_base::message_peek, error);
+    Error restore;
+    s.non_blocking(false, restore);
+    return error == boost::asio::error::would_block;
+}
+
+// tries the addresses in order, raises the last error
+void connectAny(Socket& socket, const EndPointList& ends) {
+    for (size_t i = 0; i < ends.size(); ++ i) {
+        try {
+            socket.connect(ends[i]);
+            return;
+        } catch (boost::system::system_error&) {
+            if (i + 1 == ends.size())
+                throw;
+            socket.close();
+        }
+    }
+}
+
+}
+
+struct ConnectionPool::State {
+    // the lease waiting for the connection or for the permission
+    // to create the new one
+    struct Waiter {
+        Handler proceed;
+        std::unique_ptr<Socket> socket;
+        // the connection or the slot is handed over
+        bool handed = false;
+        Waiter* next = nullptr;
+    };
+
+    struct Idle {
+        std::unique_ptr<Socket> socket;
+        int64_t since;
+    };
+
+    struct Host {
+        std::deque<Idle> idle;
+        size_t total = 0;
+        Waiter* first = nullptr;
+        Waiter* last = nullptr;
+
+        void push(Waiter& w) {
+            if (last)
+                last->next = &w;
+            else
+                first = &w;
+            last = &w;
+        }
+
+        Waiter* pop() {
+            Waiter* w = first;
+            if (w) {
+                first = w->next;
+                if (!first)
+                    last = nullptr;
+            }
+            return w;
+        }
+
+        // returns false if the waiter is already popped
+        bool remove(Waiter& w) {
+            Waiter* prev = nullptr;
+            for (Waiter* i = first; i; prev = i, i = i->next) {
+                if (i != &w)
+                    continue;
+                if (prev)
+                    prev->next = w.next;
+                else
+                    first = w.next;
+                if (last == &w)
+                    last = prev;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    typedef std::unique_lock<std::mutex> Lock;
+
+    explicit State(const PoolOptions& o) : options(o) {
+    }
+
+    // gives the connection or the slot (null socket) to the waiter,
+    // the waiter is resumed after the unlock
+    Waiter* handOver0(Host& h, std::unique_ptr<Socket>& socket) {
+        Waiter* w = h.pop();
+        if (w) {
+            w->socket = std::move(socket);
+            w->handed = true;
+        }
+        return w;
+    }
+
+    // the waiter interrupted by the event leaves the queue
+    void abort(const std::string& key, Waiter& w) {
+        {
+            Lock lock(mutex);
+            if (!hosts[key].remove(w))
+                return;
+        }
+        w.proceed();
+    }
+
+    void give(const std::string& key, std::unique_ptr<Socket> socket) {
+        Waiter* w;
+        {
+            Lock lock(mutex);
+            Host& h = hosts[key];
+            w = handOver0(h, socket);
+            if (w == nullptr) {
+                if (h.idle.size() < options.maxIdle && !closed) {
+                    h.idle.push_back({std::move(socket), nowNs()});
+                    arm0();
+                    return;
+                }
+                -- h.total;
+            }
+        }
+        if (w)
+            w->proceed();
+        else
+            socket.reset();
+    }
+
+    // the connection is dropped: its slot is given to the waiter
+    void drop(const std::string& key) {
+        Waiter* w;
+        {
+            Lock lock(mutex);
+            Host& h = hosts[key];
+            std::unique_ptr<Socket> none;
+            w = handOver0(h, none);
+            if (w == nullptr)
+                -- h.total;
+        }
+        if (w)
+            w->proceed();
+    }
+
+    void arm0() {
+        if (armed)
+            return;
+        armed = true;
+        std::weak_ptr<State> weak = self;
+        // the network service may be attached after the pool creation
+        if (!timer)
+            timer.reset(new boost::asio::deadline_timer(service<NetworkTag>()));
+        timer->expires_from_now(boost::posix_time::milliseconds(options.evictPeriodMs));
+        timer->async_wait([weak](const Error& error) {
+            std::shared_ptr<State> s = weak.lock();
+            if (s && !error)
+                s->evict();
+        });
+    }
+
+    // closes the idle connections expired or all of them
+    void evict(bool all = false) {
+        std::vector<std::unique_ptr<Socket>> expired;
+        {
+            Lock lock(mutex);
+            armed = false;
+            int64_t bound = nowNs() - int64_t(options.idleTimeoutMs) * 1000000;
+            bool left = false;
+            for (auto&& entry: hosts) {
+                Host& h = entry.second;
+                // the oldest connections are in front
+                while (!h.idle.empty() && (all || h.idle.front().since <= bound)) {
+                    expired.push_back(std::move(h.idle.front().socket));
+                    h.idle.pop_front();
+                    -- h.total;
+                }
+                left = left || !h.idle.empty();
+            }
+            if (left && !closed)
+                arm0();
+            else
+                timer.reset();
+        }
+        if (!all)
+            evicted += expired.size();
+    }
+
+    std::mutex mutex;
+    PoolOptions options;
+    std::unordered_map<std::string, Host> hosts;
+    std::unique_ptr<boost::asio::deadline_timer> timer;
+    std::weak_ptr<State> self;
+    bool armed = false;
+    bool closed = false;
+
+    std::atomic<int64_t> created{0};
+    std::atomic<int64_t> reused{0};
+    std::atomic<int64_t> broken{0};
+    std::atomic<int64_t> evicted{0};
+    std::atomic<int64_t> waited{0};
+};
+
+ConnectionPool::Lease::Lease(const std::shared_ptr<State>& s, const std::string& k,
+        std::unique_ptr<Socket> sock) :
+    state(s),
+    key(k),
+    socket(std::move(sock)) {
+}
+
+ConnectionPool::Lease::~Lease() {
+    if (!state)
+        return;
+    // the connection state is unknown after the exception
+    if (socket && !std::uncaught_exception())
+        state->give(key, std::move(socket));
+    else
+        state->drop(key);
+}
+
+Socket& ConnectionPool::Lease::operator*() {
+    VERIFY(socket, "Lease is closed");
+    return *socket;
+}
+
+Socket* ConnectionPool::Lease::operator->() {
+    return &**this;
+}
+
+void ConnectionPool::Lease::close() {
+    if (socket)
+        socket->close();
+    socket.reset();
+}
+
+ConnectionPool::ConnectionPool(const PoolOptions& options) :
+    state(std::make_shared<State>(options)) {
+    VERIFY(options.maxTotal > 0, "Pool must allow connections");
+    VERIFY(options.evictPeriodMs > 0, "Evict period must be positive");
+    state->self = state;
+}
+
+ConnectionPool::~ConnectionPool() {
+    {
+        State::Lock lock(state->mutex);
+        state->closed = true;
+    }
+    state->evict(true);
+}
+
+ConnectionPool::Lease ConnectionPool::lease(const std::string& host, int port) {
+    std::string key = host + ":" + std::to_string(port);
+    while (true) {
+        std::unique_ptr<Socket> socket;
+        {
+            State::Lock lock(state->mutex);
+            State::Host& h = state->hosts[key];
+            if (!h.idle.empty()) {
+                // the most recent connection is the warmest one
+                socket = std::move(h.idle.back().socket);
+                h.idle.pop_back();
+            } else if (h.total < state->options.maxTotal) {
+                ++ h.total;
+            } else {
+                State::Waiter w;
+                h.push(w);
+                ++ state->waited;
+                lock.release();
+                try {
+                    deferAbortable([this, &w](Handler proceed) {
+                        w.proceed = std::move(proceed);
+                        state->mutex.unlock();
+                    }, [this, &key, &w] {
+                        state->abort(key, w);
+                    });
+                } catch (std::exception&) {
+                    // the connection or the slot handed over
+                    // before the event is not lost
+                    if (w.handed) {
+                        if (w.socket)
+                            state->give(key, std::move(w.socket));
+                        else
+                            state->drop(key);
+                    }
+                    throw;
+                }
+                // either the returned connection or the slot
+                // of the dropped one
+                socket = std::move(w.socket);
+            }
+        }
+        if (socket) {
+            if (alive(*socket)) {
+                ++ state->reused;
+                return Lease(state, key, std::move(socket));
+            }
+            ++ state->broken;
+            socket.reset();
+            state->drop(key);
+            continue;
+        }
+        // connects using the acquired slot
+        Lease lease(state, key, nullptr);
+        std::unique_ptr<Socket> fresh(new Socket);
+        Error error;
+        boost::asio::ip::address address = boost::asio::ip::address::from_string(host, error);
+        if (!error) {
+            fresh->connect(EndPoint(address, port));
+        } else if (state->options.resolver) {
+            connectAny(*fresh, state->options.resolver->resolve(host, port));
+        } else {
+            Resolver resolver;
+            EndPoints ends = resolver.resolve(host, port);
+            VERIFY(ends != EndPoints(), "Cannot resolve hostname: " + host);
+            fresh->connect(*ends);
+        }
+        ++ state->created;
+        lease.socket = std::move(fresh);
+        return lease;
+    }
+}
+
+PoolStats ConnectionPool::stats() const {
+    return {state->created.load(), state->reused.load(), state->broken.load(),
+        state->evicted.load(), state->waited.load()};
+}
+
+void ConnectionPool::clear() {
+    state->evict(true);
+}
+
+}
+}
@@ -15,6 +15,7 @@
  */
 
 #include <atomic>
+#include <algorithm>
 
 #include "core.h"
 #include "journey.h"
@@ -24,17 +25,17 @@ namespace synca {
 
 typedef boost::system::error_code Error;
 
-int index() {
+int64_t index() {
     return journey().index();
 }
 
 // запуск задачи в шедулере
-Goer go(Handler handler, mt::IScheduler& scheduler) {
+Goer go(Task handler, mt::IScheduler& scheduler) {
     return Journey::create(std::move(handler), scheduler);
 }
 
 // запуск задачи в дефолтном шедулере
-Goer go(Handler handler) {
+Goer go(Task handler) {
     return Journey::create(std::move(handler), scheduler<DefaultTag>());
 }
 
@@ -47,6 +48,26 @@ void goN(int n, Handler h) {
     });
 }
 
+Goer go(Task handler, mt::IScheduler& scheduler, size_t stackSize) {
+    return Journey::create(std::move(handler), scheduler, stackSize);
+}
+
+Goer go(Task handler, size_t stackSize) {
+    return Journey::create(std::move(handler), scheduler<DefaultTag>(), stackSize);
+}
+
+void goN(int n, Handler h, size_t stackSize) {
+    if (n == 1) {
+        go(std::move(h), stackSize);
+        return;
+    }
+    go([n, h, stackSize] {
+        for (int i = 0; i < n; ++ i){
+            go(h, stackSize);
+        }
+    });
+}
+
 // перекинуть выпполнение в шедулер
 void teleport(mt::IScheduler& scheduler) {
     journey().teleport(scheduler);
@@ -64,6 +85,10 @@ void enableEvents() {
     journey().enableEvents();
 }
 
+bool eventsEnabled() {
+    return journey().eventsEnabled();
+}
+
 void defer(Handler handler) {
     journey().defer(handler);
 }
@@ -72,18 +97,18 @@ void deferProceed(ProceedHandler proceed) {
     journey().deferProceed(proceed);
 }
 
-// запустить и дождаться завершения ????
+void deferAbortable(ProceedHandler start, Handler abort) {
+    journey().deferAbortable(std::move(start), std::move(abort));
+}
+
 void goWait(std::initializer_list<Handler> handlers) {
-    deferProceed([&handlers](Handler proceed) {
-        std::shared_ptr<void> proceeder(nullptr, [proceed](void*) {
-            proceed();
+    JourneyGroup group;
+    for (const auto& handler: handlers) {
+        group.go([&handler] {
+            handler();
         });
-        for (const auto& handler: handlers) {
-            go([proceeder, &handler] {
-                handler();
-            });
-        }
-    });
+    }
+    group.wait();
 }
 
 EventsGuard::EventsGuard() {
@@ -94,61 +119,169 @@ EventsGuard::~EventsGuard() {
     enableEvents();
 }
 
-Waiter::Waiter() {
-    proceed = journey().proceedHandler();
-    init0();
+Waiter& Waiter::go(Handler handler) {
+    group.go(std::move(handler));
+    return *this;
 }
 
-Waiter::~Waiter() {
-    proceed = nullptr; // to avoid unnecessary proceeding
+void Waiter::wait() {
+    group.wait();
 }
 
-Waiter& Waiter::go(Handler handler) {
-    auto& holder = proceeder;
-    synca::go([holder, handler] { handler(); });
-    return *this;
+size_t goAnyWait(std::initializer_list<Handler> handlers) {
+    VERIFY(handlers.size() >= 1, "Handlers amount must be positive");
+
+    JourneyGroup group;
+    for (const auto& handler: handlers) {
+        group.go([&handler] {
+            handler();
+        });
+    }
+    size_t index = group.waitAny();
+    VERIFY(index < handlers.size(), "Incorrect index returned");
+    return index;
 }
 
-void Waiter::wait() {
-    if (proceeder.unique()) {
-        JLOG("everything done, nothing to do");
-        return;
+JourneyGroup::Member::Member(JourneyGroup& g, size_t index_) :
+    group(g), goer(journey().goer()), index(index_) {
+    group.enter0(*this);
+}
+
+JourneyGroup::Member::~Member() {
+    group.leave0(*this);
+}
+
+bool JourneyGroup::Member::cancelled() const {
+    return skipped;
+}
+
+void JourneyGroup::Member::fail(bool event_) {
+    error = std::current_exception();
+    event = event_;
+}
+
+JourneyGroup::JourneyGroup() {
+}
+
+JourneyGroup::~JourneyGroup() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (active == 0)
+            return;
     }
-    defer([this] {
-        auto toDestroy = std::move(proceeder);
-    });
-    init0();
+    cancel();
+    wait0(false);
+}
+
+void JourneyGroup::wait() {
+    wait0(false);
+    std::exception_ptr e = error;
+    reset0();
+    if (e)
+        std::rethrow_exception(e);
+}
+
+size_t JourneyGroup::waitAny() {
+    VERIFY(spawned > 0, "Group has no members");
+    wait0(true);
+    cancel();
+    wait0(false);
+    size_t index = first;
+    std::exception_ptr e = error;
+    reset0();
+    if (index == NONE && e)
+        std::rethrow_exception(e);
+    return index;
 }
 
-void Waiter::init0() {
-    proceeder.reset(this, [](Waiter* w) {
-        if (w->proceed != nullptr) {
-            TLOG("wait completed, proceeding");
-            w->proceed();
-        }
-    });
+void JourneyGroup::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cancel0();
 }
 
-size_t goAnyWait(std::initializer_list<Handler> handlers) {
-    VERIFY(handlers.size() >= 1, "Handlers amount must be positive");
+size_t JourneyGroup::spawn0() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++ active;
+    return spawned ++;
+}
+
+void JourneyGroup::start0(Task task, mt::IScheduler* s) {
+    synca::go(std::move(task), s ? *s : scheduler<DefaultTag>());
+}
 
-    size_t index = static_cast<size_t>(-1);
-    deferProceed([&handlers, &index](Handler proceed) {
-        std::shared_ptr<Atomic<int>> counter = std::make_shared<Atomic<int>>();
-        size_t i = 0;
-        for (const auto& handler: handlers) {
-            go([counter, proceed, &handler, i, &index] {
-                handler();
-                if (++ *counter == 1) {
-                    index = i;
-                    proceed();
-                }
-            });
-            ++ i;
+void JourneyGroup::enter0(Member& m) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cancelled) {
+        m.skipped = true;
+        return;
+    }
+    m.next = members;
+    if (members)
+        members->prev = &m;
+    members = &m;
+}
+
+// the owner may destroy the group right after proceeding,
+// so the group is not touched after the unlock
+void JourneyGroup::leave0(Member& m) {
+    Handler h;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!m.skipped) {
+            if (m.prev)
+                m.prev->next = m.next;
+            else
+                members = m.next;
+            if (m.next)
+                m.next->prev = m.prev;
+        }
+        if (!m.error) {
+            if (!m.skipped && first == NONE)
+                first = m.index;
+        } else if (!(m.event && cancelled) && !error) {
+            error = m.error;
+            cancel0();
+        }
+        -- active;
+        if (proceed && ready0()) {
+            h = std::move(proceed);
+            proceed = nullptr;
         }
+    }
+    if (h)
+        h();
+}
+
+void JourneyGroup::cancel0() {
+    cancelled = true;
+    for (Member* m = members; m; m = m->next)
+        m->goer.cancel();
+}
+
+bool JourneyGroup::ready0() const {
+    return active == 0 || (any && (first != NONE || error));
+}
+
+// the mutex is released after the journey is suspended
+void JourneyGroup::wait0(bool any_) {
+    std::unique_lock<std::mutex> lock(mutex);
+    any = any_;
+    if (ready0())
+        return;
+    lock.release();
+    deferProceed([this](Handler p) {
+        proceed = std::move(p);
+        mutex.unlock();
     });
-    VERIFY(index < handlers.size(), "Incorrect index returned");
-    return index;
+}
+
+// the group may be reused after the wait
+void JourneyGroup::reset0() {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = nullptr;
+    first = NONE;
+    spawned = 0;
+    cancelled = false;
 }
 
 Alone::Alone(mt::IService& service, const char* name) :
@@ -163,20 +296,37 @@ const char* Alone::name() const {
     return strandName;
 }
 
-Timeout::Timeout(int ms) :
-    timer(service<TimeoutTag>(), boost::posix_time::milliseconds(ms)) {
+Timeout::Timeout(int ms) {
     Goer goer = journey().goer();
-    timer.async_wait([goer](const Error& error) mutable {
-        if (!error)
-            goer.timedout();
+    timer.start(wheel<TimeoutTag>(), ms, [goer]() mutable {
+        goer.timedout();
     });
 }
 
 Timeout::~Timeout() {
-    timer.cancel_one();
+    timer.cancel();
     handleEvents();
 }
 
+Deadline::Deadline(int ms) {
+    Journey& j = journey();
+    prev = j.deadline();
+    int64_t d = nowNs() + int64_t(ms) * 1000000;
+    if (d < prev)
+        j.setDeadline(d);
+}
+
+Deadline::~Deadline() {
+    journey().setDeadline(prev);
+}
+
+int64_t deadlineLeft() {
+    int64_t d = journey().deadline();
+    if (d == NO_DEADLINE)
+        return -1;
+    return std::max<int64_t>(0, (d - nowNs()) / 1000000);
+}
+
 void Service::attach(mt::IService& s) {
     service = &s.ioService();
 }
@@ -26,6 +26,28 @@ namespace coro {
 
 TLS Coro* t_coro = nullptr;
 
+// boost coroutine stack allocator over the stacks pool,
+// keeps the allocated stack in the coro for measurements
+struct PooledStackAllocator {
+    PooledStackAllocator(Stack& s) : stack(&s) {}
+
+    void allocate(bc::stack_context& ctx, std::size_t size) {
+        *stack = stackPool().allocate(size);
+#ifdef flagSTACK_STATS
+        paint(*stack);
+#endif
+        ctx.size = stack->size;
+        ctx.sp = stack->top();
+    }
+
+    void deallocate(bc::stack_context&) {
+        stackPool().deallocate(*stack);
+    }
+
+private:
+    Stack* stack;
+};
+
 // switch context from coroutine
 void yield() {
     VERIFY(isInsideCoro(), "yield() outside coro");
@@ -46,6 +68,10 @@ Coro::Coro(Handler handler) {
     start(std::move(handler));
 }
 
+Coro::Coro(size_t stackSize) {
+    init0(stackSize);
+}
+
 Coro::~Coro() {
     if (isStarted())
         RLOG("Destroying started coro");
@@ -53,13 +79,12 @@ Coro::~Coro() {
 
 void Coro::start(Handler handler) {
     VERIFY(!isStarted(), "Trying to start already started coro");
-    coroutine = new PushCoroutine([this](PullCoroutine& source) {
+    coroutine = PushCoroutine([this](PullCoroutine& source) {
         savedCoroutine = &source;
 
         const Handler& handler = source.get();
         starter0(handler);
-        return;
-    });
+    }, bc::attributes(size, bc::no_stack_unwind), PooledStackAllocator(stack));
     jump0(handler);
 }
 
@@ -75,9 +100,23 @@ bool Coro::isStarted() const {
     return started || running;
 }
 
-void Coro::init0() {
+size_t Coro::stackSize() const {
+    return stack.ptr ? stack.size : size;
+}
+
+size_t Coro::stackUsage() const {
+#ifdef flagSTACK_STATS
+    return stack.ptr ? usage(stack) : 0;
+#else
+    return 0;
+#endif
+}
+
+void Coro::init0(size_t size_) {
     started = false;
     running = false;
+    savedCoroutine = nullptr;
+    size = size_;
 }
 
 // returns to saved context
@@ -92,7 +131,7 @@ void Coro::jump0(const Handler& p) {
     std::swap(old, t_coro);
     running = true;
 
-    (*coroutine)(p);
+    coroutine(p);
 
     running = false;
     std::swap(old, t_coro);
@@ -110,8 +149,8 @@ void Coro::starter0(const Handler& handler) {
     } catch (...) {
         exc = std::current_exception();
     }
+    // returning completes the coroutine: it's destroyed without stack unwinding
     started = false;
-    yield0();
 }
 
 }
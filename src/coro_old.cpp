@@ -24,7 +24,6 @@
 namespace coro {
 
 TLS Coro* t_coro = nullptr;
-const size_t STACK_SIZE = 1024*32;
 
 // switch context from coroutine
 void yield()
@@ -50,16 +49,25 @@ Coro::Coro(Handler handler)
     start(std::move(handler));
 }
 
+Coro::Coro(size_t stackSize)
+{
+    init0(stackSize);
+}
+
 Coro::~Coro()
 {
     if (isStarted())
         RLOG("Destroying started coro");
+    stackPool().deallocate(stack);
 }
 
 void Coro::start(Handler handler)
 {
     VERIFY(!isStarted(), "Trying to start already started coro");
-    context = boost::context::make_fcontext(&stack.back(), stack.size(), &starterWrapper0);
+#ifdef flagSTACK_STATS
+    paint(stack);
+#endif
+    context = boost::context::make_fcontext(stack.top(), stack.size, &starterWrapper0);
     jump0(reinterpret_cast<intptr_t>(&handler));
 }
 
@@ -77,12 +85,26 @@ bool Coro::isStarted() const
     return started || running;
 }
 
-void Coro::init0()
+size_t Coro::stackSize() const
+{
+    return stack.size;
+}
+
+size_t Coro::stackUsage() const
+{
+#ifdef flagSTACK_STATS
+    return usage(stack);
+#else
+    return 0;
+#endif
+}
+
+void Coro::init0(size_t size)
 {
     started = false;
     running = false;
     context = nullptr;
-    stack.resize(STACK_SIZE);
+    stack = stackPool().allocate(size);
 }
 
 // returns to saved context
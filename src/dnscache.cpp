@@ -0,0 +1,71 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dnscache.h"
+#include "core.h"
+#include "helpers.h"
+
+namespace synca {
+namespace net {
+
+CachingResolver::CachingResolver(const ResolverOptions& o, ResolveBackend b) :
+    backend(std::move(b)),
+    lookups(o.ttlMs, o.negativeTtlMs) {
+}
+
+EndPointList CachingResolver::resolve(const std::string& host, int port) {
+    EndPointList ends;
+    try {
+        ends = lookups.get(host, [this, &host] {
+            return lookup0(host);
+        });
+    } catch (EventException&) {
+        // the cancellation is not the failure
+        throw;
+    } catch (std::exception&) {
+        ++ failures;
+        throw;
+    }
+    for (EndPoint& e: ends)
+        e.port(port);
+    return ends;
+}
+
+ResolverStats CachingResolver::stats() const {
+    SingleFlightStats s = lookups.stats();
+    return {s.memoized, s.loads, s.shared, failures.load()};
+}
+
+// the lookups in flight are kept for their waiters
+void CachingResolver::clear() {
+    lookups.clear();
+}
+
+EndPointList CachingResolver::lookup0(const std::string& host) {
+    EndPointList ends;
+    if (backend) {
+        ends = backend(host);
+    } else {
+        Resolver resolver;
+        for (EndPoints it = resolver.resolve(host, 0); it != EndPoints(); ++ it)
+            ends.push_back(*it);
+    }
+    VERIFY(!ends.empty(), "No addresses are resolved");
+    return ends;
+}
+
+}
+}
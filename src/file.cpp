@@ -0,0 +1,643 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#ifdef flagMSC
+#   include <io.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#endif
+
+#ifdef flagURING
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <linux/io_uring.h>
+#endif
+
+#include <boost/system/system_error.hpp>
+
+#include "file.h"
+#include "core.h"
+#include "journey.h"
+#include "helpers.h"
+
+namespace synca {
+
+namespace {
+
+enum OpType {
+    OT_READ,
+    OT_WRITE,
+    OT_FSYNC,
+};
+
+std::atomic<FileBackend> fileBackendMode(FB_AUTO);
+
+// the error is the system error code: errno or GetLastError
+void raise(int error, const char* what) {
+    throw boost::system::system_error(
+        boost::system::error_code(error, boost::system::system_category()), what);
+}
+
+// the error of the C runtime call
+void raiseErrno(const char* what) {
+    throw boost::system::system_error(
+        boost::system::error_code(errno, boost::system::generic_category()), what);
+}
+
+#ifdef flagMSC
+
+int openFile(const std::string& path, int mode) {
+    int flags = (mode & File::FM_WRITE) ? ((mode & File::FM_READ) ? _O_RDWR : _O_WRONLY) : _O_RDONLY;
+    if (mode & File::FM_CREATE)
+        flags |= _O_CREAT;
+    if (mode & File::FM_TRUNCATE)
+        flags |= _O_TRUNC;
+    return ::_open(path.c_str(), flags | _O_BINARY | _O_NOINHERIT, _S_IREAD | _S_IWRITE);
+}
+
+void closeFile(int fd) {
+    ::_close(fd);
+}
+
+int64_t fileSize(int fd) {
+    struct _stat64 st;
+    return ::_fstat64(fd, &st) < 0 ? -1 : st.st_size;
+}
+
+// the positional operations use the offset of OVERLAPPED
+// on the synchronous handle
+int64_t blockingOp(OpType type, int fd, char* data, size_t size, uint64_t offset) {
+    HANDLE h = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+    OVERLAPPED ov = {};
+    ov.Offset = DWORD(offset);
+    ov.OffsetHigh = DWORD(offset >> 32);
+    DWORD n = DWORD(std::min<size_t>(size, MAXDWORD));
+    DWORD done = 0;
+    BOOL ok;
+    switch (type) {
+    case OT_READ:
+        ok = ::ReadFile(h, data, n, &done, &ov);
+        if (!ok && ::GetLastError() == ERROR_HANDLE_EOF)
+            return 0;
+        break;
+    case OT_WRITE:
+        ok = ::WriteFile(h, data, n, &done, &ov);
+        break;
+    default:
+        ok = ::FlushFileBuffers(h);
+        break;
+    }
+    return ok ? int64_t(done) : -int64_t(::GetLastError());
+}
+
+#else
+
+int openFile(const std::string& path, int mode) {
+    int flags = (mode & File::FM_WRITE) ? ((mode & File::FM_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+    if (mode & File::FM_CREATE)
+        flags |= O_CREAT;
+    if (mode & File::FM_TRUNCATE)
+        flags |= O_TRUNC;
+    int f;
+    do {
+        f = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    } while (f < 0 && errno == EINTR);
+    return f;
+}
+
+void closeFile(int fd) {
+    ::close(fd);
+}
+
+int64_t fileSize(int fd) {
+    struct stat st;
+    return ::fstat(fd, &st) < 0 ? -1 : int64_t(st.st_size);
+}
+
+// returns the size or the negative error
+int64_t blockingOp(OpType type, int fd, char* data, size_t size, uint64_t offset) {
+    ssize_t r;
+    do {
+        switch (type) {
+        case OT_READ:
+            r = ::pread(fd, data, size, offset);
+            break;
+        case OT_WRITE:
+            r = ::pwrite(fd, data, size, offset);
+            break;
+        default:
+            r = ::fsync(fd);
+            break;
+        }
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -errno : r;
+}
+
+#endif
+
+// the blocking call is performed on the file scheduler,
+// the journey returns to its scheduler after the call
+int64_t poolOp(OpType type, int fd, char* data, size_t size, uint64_t offset) {
+    mt::IScheduler& origin = journey().scheduler();
+    teleport(scheduler<FileTag>());
+    int64_t r = blockingOp(type, fd, data, size, offset);
+    teleport(origin);
+    return r;
+}
+
+#ifdef flagURING
+
+// io_uring driven by the raw system calls: the journeys submit the requests
+// under the lock, the completion thread resumes the journeys
+struct Uring {
+    struct Op {
+        Handler proceed;
+        int res = 0;
+        bool submitted = true;
+    };
+
+    static const unsigned ENTRIES = 256;
+
+    Uring() {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = int(syscall(__NR_io_uring_setup, ENTRIES, &p));
+        if (fd < 0)
+            return;
+        sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+        sq = map0(sqSize, IORING_OFF_SQ_RING);
+        cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq : map0(cqSize, IORING_OFF_CQ_RING);
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = map0(sqesSize, IORING_OFF_SQES);
+        if (sq == nullptr || cq == nullptr || s == nullptr) {
+            unmap0();
+            if (s)
+                munmap(s, sqesSize);
+            ::close(fd);
+            fd = -1;
+            return;
+        }
+        sqes = static_cast<io_uring_sqe*>(s);
+        sqHead = ptr0<unsigned>(sq, p.sq_off.head);
+        sqTail = ptr0<unsigned>(sq, p.sq_off.tail);
+        sqMask = *ptr0<unsigned>(sq, p.sq_off.ring_mask);
+        sqEntries = p.sq_entries;
+        sqArray = ptr0<unsigned>(sq, p.sq_off.array);
+        cqHead = ptr0<unsigned>(cq, p.cq_off.head);
+        cqTail = ptr0<unsigned>(cq, p.cq_off.tail);
+        cqMask = *ptr0<unsigned>(cq, p.cq_off.ring_mask);
+        cqEntries = p.cq_entries;
+        cqes = ptr0<io_uring_cqe>(cq, p.cq_off.cqes);
+        reaper = mt::createThread([this] {
+            reap0();
+        }, 0, "uring");
+    }
+
+    ~Uring() {
+        if (fd < 0)
+            return;
+        // the request without the op stops the completion thread
+        while (!submit(nullptr, IORING_OP_NOP, -1, nullptr, 0))
+            std::this_thread::yield();
+        reaper.join();
+        munmap(sqes, sqesSize);
+        unmap0();
+        ::close(fd);
+    }
+
+    bool available() const {
+        return fd >= 0;
+    }
+
+    // returns false if the request is not accepted: the ring is full
+    bool submit(Op* op, int opcode, int file, const iovec* iov, uint64_t offset) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (inflight.load() >= cqEntries)
+            return false;
+        unsigned tail = *sqTail;
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= sqEntries)
+            return false;
+        unsigned i = tail & sqMask;
+        io_uring_sqe& sqe = sqes[i];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = uint8_t(opcode);
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(iov);
+        sqe.len = iov ? 1 : 0;
+        sqe.off = offset;
+        sqe.user_data = reinterpret_cast<uint64_t>(op);
+        sqArray[i] = i;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++ inflight;
+        long r;
+        do {
+            r = syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0);
+        } while (r < 0 && errno == EINTR);
+        if (r != 1) {
+            // the request is not consumed by the kernel
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            -- inflight;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    template<typename T>
+    static T* ptr0(void* base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    void* map0(size_t size, off_t offset) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    void unmap0() {
+        if (cq && cq != sq)
+            munmap(cq, cqSize);
+        if (sq)
+            munmap(sq, sqSize);
+    }
+
+    void reap0() {
+        while (true) {
+            long r = syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                RAISE("io_uring wait failed: " + std::string(std::strerror(errno)));
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                io_uring_cqe& cqe = cqes[head & cqMask];
+                Op* op = reinterpret_cast<Op*>(cqe.user_data);
+                int res = cqe.res;
+                __atomic_store_n(cqHead, ++ head, __ATOMIC_RELEASE);
+                if (op == nullptr)
+                    return;
+                -- inflight;
+                // the op is destroyed by the resumed journey
+                op->res = res;
+                Handler proceed = std::move(op->proceed);
+                proceed();
+            }
+        }
+    }
+
+    int fd = -1;
+    std::mutex mutex;
+    std::atomic<unsigned> inflight{0};
+    std::thread reaper;
+
+    void* sq = nullptr;
+    void* cq = nullptr;
+    size_t sqSize = 0;
+    size_t cqSize = 0;
+    size_t sqesSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cqMask = 0;
+    unsigned cqEntries = 0;
+};
+
+Uring& uring() {
+    static Uring u;
+    return u;
+}
+
+bool useUring() {
+    FileBackend b = fileBackendMode.load();
+    if (b == FB_POOL)
+        return false;
+    bool available = uring().available();
+    VERIFY(available || b == FB_AUTO, "io_uring is not available");
+    return available;
+}
+
+int64_t uringOp(OpType type, int fd, char* data, size_t size, uint64_t offset) {
+    static const int opcodes[] = {IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_FSYNC};
+    Uring::Op op;
+    iovec iov = {data, size};
+    const iovec* v = type == OT_FSYNC ? nullptr : &iov;
+    deferProceed([&op, type, fd, v, offset](Handler proceed) {
+        op.proceed = std::move(proceed);
+        if (uring().submit(&op, opcodes[type], fd, v, offset))
+            return;
+        op.submitted = false;
+        Handler p = std::move(op.proceed);
+        p();
+    });
+    // the ring is full: the operation is performed on the file scheduler
+    if (!op.submitted)
+        return poolOp(type, fd, data, size, offset);
+    return op.res;
+}
+
+#else
+
+bool useUring() {
+    VERIFY(fileBackendMode.load() != FB_URING, "io_uring is not supported");
+    return false;
+}
+
+int64_t uringOp(OpType, int, char*, size_t, uint64_t) {
+    RAISE("io_uring is not supported");
+}
+
+#endif
+
+// the events are postponed while the operation is in progress: the result
+// of the completed operation is never lost, the pending event is thrown
+// at the next suspension of the journey
+struct PostponeEvents {
+    PostponeEvents() : allowed(journey().allowEvents(false)) {}
+    ~PostponeEvents() {
+        journey().allowEvents(allowed);
+    }
+
+private:
+    bool allowed;
+};
+
+int64_t fileOp(OpType type, int fd, char* data, size_t size, uint64_t offset) {
+    VERIFY(fd >= 0, "File is not opened");
+    PostponeEvents postpone;
+    return useUring()
+        ? uringOp(type, fd, data, size, offset)
+        : poolOp(type, fd, data, size, offset);
+}
+
+}
+
+void setFileBackend(FileBackend backend) {
+    fileBackendMode = backend;
+}
+
+FileBackend fileBackend() {
+    return useUring() ? FB_URING : FB_POOL;
+}
+
+//////////////////////////////////////////////////////////////////
+// File class
+//////////////////////////////////////////////////////////////////
+File::File() : fd(-1), pos(0) {
+}
+
+File::File(const std::string& path, int mode) : File() {
+    open(path, mode);
+}
+
+File::File(File&& f) : fd(f.fd), pos(f.pos) {
+    f.fd = -1;
+}
+
+File::~File() {
+    close();
+}
+
+void File::open(const std::string& path, int mode) {
+    VERIFY(fd < 0, "File is already opened");
+    int f = openFile(path, mode);
+    if (f < 0)
+        raiseErrno("synca file open");
+    fd = f;
+    pos = (mode & FM_APPEND) ? size() : 0;
+}
+
+void File::close() {
+    if (fd < 0)
+        return;
+    closeFile(fd);
+    fd = -1;
+    pos = 0;
+}
+
+bool File::isOpen() const {
+    return fd >= 0;
+}
+
+void File::read(Buffer& buffer) {
+    pread(buffer, pos);
+    pos += buffer.size();
+}
+
+void File::write(const Buffer& buffer) {
+    pwrite(buffer, pos);
+    pos += buffer.size();
+}
+
+void File::pread(Buffer& buffer, uint64_t offset) {
+    size_t done = 0;
+    while (done < buffer.size()) {
+        int64_t r = fileOp(OT_READ, fd, &buffer[done], buffer.size() - done, offset + done);
+        if (r < 0)
+            raise(int(-r), "synca file read");
+        if (r == 0)
+            break;
+        done += size_t(r);
+    }
+    buffer.resize(done);
+}
+
+void File::pwrite(const Buffer& buffer, uint64_t offset) {
+    pwrite(buffer.data(), buffer.size(), offset);
+}
+
+void File::pwrite(const char* data, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        // the write doesn't modify the data
+        int64_t r = fileOp(OT_WRITE, fd, const_cast<char*>(data + done), size - done, offset + done);
+        if (r < 0)
+            raise(int(-r), "synca file write");
+        done += size_t(r);
+    }
+}
+
+void File::fsync() {
+    int64_t r = fileOp(OT_FSYNC, fd, nullptr, 0, 0);
+    if (r < 0)
+        raise(int(-r), "synca file fsync");
+}
+
+uint64_t File::size() const {
+    VERIFY(fd >= 0, "File is not opened");
+    int64_t size = fileSize(fd);
+    if (size < 0)
+        raiseErrno("synca file stat");
+    return uint64_t(size);
+}
+
+uint64_t File::position() const {
+    return pos;
+}
+
+//////////////////////////////////////////////////////////////////
+// LogStore class
+//////////////////////////////////////////////////////////////////
+
+namespace {
+
+// record: key size, value size, checksum, key, value
+const size_t HEADER_SIZE = 3 * sizeof(uint32_t);
+const size_t REPLAY_CHUNK = 64 * 1024;
+
+// FNV-1a of the sizes and the data
+uint32_t checksum(const char* data, size_t size, uint32_t h = 2166136261u) {
+    for (size_t i = 0; i < size; ++ i)
+        h = (h ^ uint8_t(data[i])) * 16777619u;
+    return h;
+}
+
+uint32_t recordChecksum(uint32_t keySize, uint32_t valueSize, const char* data) {
+    uint32_t sizes[] = {keySize, valueSize};
+    uint32_t h = checksum(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    return checksum(data, keySize + valueSize, h);
+}
+
+}
+
+LogStore::LogStore() : end(0) {
+}
+
+void LogStore::open(const std::string& path) {
+    file.open(path, File::FM_READ | File::FM_WRITE | File::FM_CREATE);
+    replay0();
+}
+
+bool LogStore::isOpen() const {
+    return file.isOpen();
+}
+
+boost::optional<std::string> LogStore::get(const std::string& key) {
+    Location l;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+            return boost::optional<std::string>();
+        l = it->second;
+    }
+    Buffer value(l.size, 0);
+    file.pread(value, l.offset);
+    VERIFY(value.size() == l.size, "Log record is truncated");
+    return boost::optional<std::string>(std::move(value));
+}
+
+void LogStore::set(const std::string& key, const std::string& value) {
+    VERIFY(key.size() <= UINT32_MAX && value.size() <= UINT32_MAX, "Record is too large");
+    uint32_t sizes[] = {uint32_t(key.size()), uint32_t(value.size())};
+    Buffer record;
+    record.reserve(HEADER_SIZE + key.size() + value.size());
+    record.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    record.append(HEADER_SIZE - sizeof(sizes), '\0');
+    record.append(key);
+    record.append(value);
+    uint32_t sum = recordChecksum(sizes[0], sizes[1], &record[HEADER_SIZE]);
+    std::memcpy(&record[sizeof(sizes)], &sum, sizeof(sum));
+    uint64_t offset;
+    {
+        // the region is reserved, the concurrent writes don't overlap
+        std::lock_guard<std::mutex> lock(mutex);
+        offset = end;
+        end += record.size();
+    }
+    file.pwrite(record, offset);
+    Location l = {offset + HEADER_SIZE + key.size(), uint32_t(value.size())};
+    std::lock_guard<std::mutex> lock(mutex);
+    // the latest record in the log wins as on the replay
+    auto it = index.find(key);
+    if (it == index.end())
+        index.emplace(key, l);
+    else if (it->second.offset < l.offset)
+        it->second = l;
+}
+
+void LogStore::sync() {
+    file.fsync();
+}
+
+size_t LogStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+void LogStore::replay0() {
+    uint64_t fileSize = file.size();
+    // the data read from the file starting from the offset
+    Buffer data;
+    uint64_t offset = 0;
+    bool torn = false;
+    while (!torn) {
+        size_t p = 0;
+        while (data.size() - p >= HEADER_SIZE) {
+            uint32_t h[3];
+            std::memcpy(h, &data[p], sizeof(h));
+            uint64_t recordSize = HEADER_SIZE + uint64_t(h[0]) + h[1];
+            if (offset + p + recordSize > fileSize) {
+                torn = true;
+                break;
+            }
+            if (data.size() - p < recordSize)
+                break;
+            const char* body = &data[p + HEADER_SIZE];
+            if (recordChecksum(h[0], h[1], body) != h[2]) {
+                torn = true;
+                break;
+            }
+            index[std::string(body, h[0])] = {offset + p + HEADER_SIZE + h[0], h[1]};
+            p += recordSize;
+        }
+        data.erase(0, p);
+        offset += p;
+        uint64_t next = offset + data.size();
+        if (torn || next >= fileSize)
+            break;
+        Buffer chunk(REPLAY_CHUNK, 0);
+        file.pread(chunk, next);
+        if (chunk.empty())
+            break;
+        data += chunk;
+    }
+    // the torn tail is overwritten by the next records
+    end = offset;
+    JLOG("log replayed: " << index.size() << " keys, " << end << " of " << fileSize << " bytes");
+}
+
+}
@@ -17,6 +17,7 @@
 #include <string>
 
 #include "goer.h"
+#include "pool.h"
 #include "helpers.h"
 
 namespace synca {
@@ -46,13 +47,11 @@ EventStatus EventException::status() {
     return st;
 }
 
-Goer::Goer() : state(std::make_shared<State>()) {
+Goer::Goer() : state(std::allocate_shared<State>(PoolAllocator<State>())) {
 }
 
 EventStatus Goer::reset() {
-    EventStatus s = state0().status;
-    state0().status = ES_NORMAL;
-    return s;
+    return state0().status.exchange(ES_NORMAL);
 }
 
 bool Goer::cancel() {
@@ -63,11 +62,30 @@ bool Goer::timedout() {
     return setStatus0(ES_TIMEDOUT);
 }
 
+void Goer::startAbortable(const Handler& start, Handler abort) {
+    State& s = state0();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    start();
+    s.abort = std::move(abort);
+    // the event set before the registration
+    if (s.status.load() != ES_NORMAL)
+        s.abort();
+}
+
+void Goer::resetAbort() {
+    State& s = state0();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.abort = nullptr;
+}
+
 bool Goer::setStatus0(EventStatus s) {
-    auto& ss = state0().status;
-    if (ss != ES_NORMAL)
+    State& st = state0();
+    EventStatus expected = ES_NORMAL;
+    if (!st.status.compare_exchange_strong(expected, s))
         return false;
-    ss = s;
+    std::lock_guard<std::mutex> lock(st.mutex);
+    if (st.abort)
+        st.abort();
     return true;
 }
 
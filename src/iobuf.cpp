@@ -0,0 +1,264 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "iobuf.h"
+#include "pool.h"
+#include "helpers.h"
+
+namespace synca {
+namespace io {
+
+Block* Block::create() {
+    Block* b = new (BlockPool<Block>::allocate()) Block;
+    b->refs.store(0, std::memory_order_relaxed);
+    b->used = 0;
+    return b;
+}
+
+void Block::acquire(Block* b) {
+    b->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Block::release(Block* b) {
+    if (b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    b->~Block();
+    BlockPool<Block>::deallocate(b);
+}
+
+Slice::Slice(Block* b, size_t offset, size_t size) : block(b), off(offset), len(size) {
+    Block::acquire(block);
+}
+
+Slice::Slice(const Slice& s) : block(s.block), off(s.off), len(s.len) {
+    if (block)
+        Block::acquire(block);
+}
+
+Slice::Slice(Slice&& s) : block(s.block), off(s.off), len(s.len) {
+    s.block = nullptr;
+    s.len = 0;
+}
+
+Slice::~Slice() {
+    if (block)
+        Block::release(block);
+}
+
+Slice& Slice::operator=(Slice s) {
+    std::swap(block, s.block);
+    std::swap(off, s.off);
+    std::swap(len, s.len);
+    return *this;
+}
+
+const char* Slice::data() const {
+    return block ? block->data + off : nullptr;
+}
+
+size_t Slice::size() const {
+    return len;
+}
+
+bool Slice::empty() const {
+    return len == 0;
+}
+
+Slice Slice::sub(size_t pos, size_t n) const {
+    VERIFY(pos + n <= len, "Slice range is out of bounds");
+    return {block, off + pos, n};
+}
+
+Buffer Slice::str() const {
+    return Buffer(data(), len);
+}
+
+// the data may be appended in place only by the exclusive owner
+// of the block tip
+bool Chain::writable0(const Slice& s) {
+    const Block* b = s.block;
+    return b->refs.load(std::memory_order_acquire) == 1
+        && s.data() + s.size() == b->data + b->used
+        && b->used < Block::SIZE;
+}
+
+Chain::Chain(const Buffer& b) {
+    append(b);
+}
+
+void Chain::append(const char* data, size_t n) {
+    while (n > 0) {
+        if (items.empty() || !writable0(items.back()))
+            items.emplace_back(Block::create(), 0, 0);
+        Slice& s = items.back();
+        Block* b = s.block;
+        size_t take = std::min(n, Block::SIZE - b->used);
+        std::memcpy(b->data + b->used, data, take);
+        b->used += take;
+        s.len += take;
+        length += take;
+        data += take;
+        n -= take;
+    }
+    prepared = items.size();
+}
+
+void Chain::append(const Buffer& b) {
+    append(b.data(), b.size());
+}
+
+void Chain::append(const Slice& s) {
+    if (s.empty())
+        return;
+    items.push_back(s);
+    length += s.size();
+    prepared = items.size();
+}
+
+void Chain::append(const Chain& c) {
+    for (const Slice& s: c.items)
+        append(s);
+}
+
+void Chain::prepare(size_t n, std::vector<Region>& regions) {
+    regions.clear();
+    prepared = items.size();
+    size_t room = 0;
+    if (!items.empty() && writable0(items.back())) {
+        Block* b = items.back().block;
+        prepared = items.size() - 1;
+        regions.push_back({b->data + b->used, Block::SIZE - b->used});
+        room += Block::SIZE - b->used;
+    }
+    while (room < n) {
+        items.emplace_back(Block::create(), 0, 0);
+        regions.push_back({items.back().block->data, Block::SIZE});
+        room += Block::SIZE;
+    }
+}
+
+void Chain::commit(size_t n) {
+    for (size_t i = prepared; i < items.size() && n > 0; ++ i) {
+        Slice& s = items[i];
+        Block* b = s.block;
+        size_t take = std::min(n, Block::SIZE - b->used);
+        b->used += take;
+        s.len += take;
+        length += take;
+        n -= take;
+    }
+    VERIFY(n == 0, "Committed more than prepared");
+    while (!items.empty() && items.back().empty())
+        items.pop_back();
+    prepared = items.size();
+}
+
+size_t Chain::size() const {
+    return length;
+}
+
+bool Chain::empty() const {
+    return length == 0;
+}
+
+const std::deque<Slice>& Chain::slices() const {
+    return items;
+}
+
+size_t Chain::find(const Buffer& pattern, size_t pos) const {
+    if (pattern.empty())
+        return pos <= length ? pos : npos;
+    size_t start = 0;
+    for (size_t i = 0; i < items.size(); ++ i) {
+        const Slice& s = items[i];
+        for (size_t j = pos > start ? pos - start : 0; j < s.size(); ++ j) {
+            // memchr skips to the candidates using the vectorized scan
+            const void* c = std::memchr(s.data() + j, pattern[0], s.size() - j);
+            if (c == nullptr)
+                break;
+            j = static_cast<const char*>(c) - s.data();
+            // compares the rest possibly crossing the slices
+            size_t si = i;
+            size_t sj = j;
+            size_t k = 0;
+            while (k < pattern.size() && si < items.size()) {
+                if (items[si].data()[sj] != pattern[k])
+                    break;
+                ++ k;
+                if (++ sj == items[si].size()) {
+                    ++ si;
+                    sj = 0;
+                }
+            }
+            if (k == pattern.size())
+                return start + j;
+        }
+        start += s.size();
+    }
+    return npos;
+}
+
+Chain Chain::split(size_t n) {
+    VERIFY(n <= length, "Split position is out of bounds");
+    Chain head;
+    while (n > 0) {
+        Slice& s = items.front();
+        if (s.size() <= n) {
+            n -= s.size();
+            head.length += s.size();
+            length -= s.size();
+            head.items.push_back(std::move(s));
+            items.pop_front();
+        } else {
+            head.append(s.sub(0, n));
+            s.off += n;
+            s.len -= n;
+            length -= n;
+            n = 0;
+        }
+    }
+    head.prepared = head.items.size();
+    prepared = items.size();
+    return head;
+}
+
+void Chain::skip(size_t n) {
+    split(n);
+}
+
+void Chain::clear() {
+    items.clear();
+    length = 0;
+    prepared = 0;
+}
+
+Buffer Chain::str(size_t n) const {
+    n = std::min(n, length);
+    Buffer b;
+    b.reserve(n);
+    for (size_t i = 0; n > 0; ++ i) {
+        size_t take = std::min(n, items[i].size());
+        b.append(items[i].data(), take);
+        n -= take;
+    }
+    return b;
+}
+
+}
+}
@@ -16,6 +16,10 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 #include "journey.h"
 #include "helpers.h"
@@ -23,25 +27,107 @@
 namespace synca {
 
 TLS Journey* t_journey = nullptr;
-    
+
+// scheduler executing the current step and the journey handed off within it
+TLS mt::IScheduler* t_scheduler = nullptr;
+TLS Journey* t_next = nullptr;
+
+// consecutive handoffs per step: ping-pong pairs must not starve others
+const int HANDOFF_BUDGET = 16;
+
+std::atomic<bool> handoffEnabled(false);
+
+// journey indices are taken from the global sequence by blocks
+const int64_t INDEX_BLOCK = 1024;
+
+TLS int64_t t_nextIndex = 0;
+TLS int64_t t_lastIndex = 0;
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct JourneyIndexTag;
 struct JourneyCreateTag;
 struct JourneyDestroyTag;
 
+int64_t nextIndex() {
+    if (t_nextIndex == t_lastIndex) {
+        t_nextIndex = atomic<JourneyIndexTag>().fetch_add(INDEX_BLOCK);
+        t_lastIndex = t_nextIndex + INDEX_BLOCK;
+    }
+    return ++ t_nextIndex;
+}
+
+// Live journeys tracking using the sharded counters: journey churn
+// doesn't touch the shared cache line. Counters are monotonic,
+// destructions are summed before creations, so the journey counted as
+// destroyed is always counted as created. Waiters block on the condition
+// variable, the destroying thread checks the counts only while somebody
+// waits.
+struct Completion {
+    void created() {
+        ++ counter<JourneyCreateTag>();
+    }
+
+    void destroyed() {
+        ++ counter<JourneyDestroyTag>();
+        // pairs with the fence in wait: either the waiter sees
+        // the destruction or the destroyer sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0 || !done0())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        cond.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++ waiters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cond.wait(lock, [this] {
+            return done0();
+        });
+        -- waiters;
+    }
 
-Journey::Journey(mt::IScheduler& s) :
+private:
+    bool done0() const {
+        int64_t destroyed = counter<JourneyDestroyTag>();
+        return counter<JourneyCreateTag>() == destroyed;
+    }
+
+    std::atomic<int> waiters{0};
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+Completion& completion() {
+    return single<Completion>();
+}
+
+
+Journey::Journey(mt::IScheduler& s, size_t stackSize) :
     eventsAllowed(true),
     sched(&s),
-    indx(++ atomic<JourneyCreateTag>()) {
+    coro(stackSize),
+    indx(nextIndex()),
+    deadlineNs(NO_DEADLINE),
+    armedNs(NO_DEADLINE) {
+    completion().created();
 }
 
 Journey::~Journey() {
-    ++ atomic<JourneyDestroyTag>();
+#ifdef flagSTACK_STATS
+    RTLOG("[" << indx << "] stack usage: " << coro.stackUsage() << " of " << coro.stackSize());
+#endif
+    completion().destroyed();
 }
 
 void Journey::proceed() {
-    schedule0([this] {
-        proceed0();
-    });
+    if (!handoff0())
+        scheduleProceed0();
 }
 
 Handler Journey::proceedHandler() {
@@ -52,6 +138,7 @@ Handler Journey::proceedHandler() {
 
 void Journey::defer(Handler handler) {
     handleEvents();
+    armDeadline0();
     deferHandler = handler;
     coro::yield();
     handleEvents();
@@ -65,6 +152,28 @@ void Journey::deferProceed(ProceedHandler proceed) {
     defer(localHandler);
 }
 
+// the events are not handled before the suspension: the event set earlier
+// aborts the operation right after the start
+void Journey::deferAbortable(ProceedHandler start, Handler abort) {
+    if (!eventsAllowed) {
+        deferProceed(start);
+        return;
+    }
+    checkDeadline0();
+    armDeadline0();
+    deferHandler = [this, &start, &abort] {
+        Handler proceed = proceedHandler();
+        // the journey may be resumed right after the start,
+        // but it waits for the lock to reset the abort handler
+        gr.startAbortable([&start, &proceed] {
+            start(proceed);
+        }, std::move(abort));
+    };
+    coro::yield();
+    gr.resetAbort();
+    handleEvents();
+}
+
 void Journey::teleport(mt::IScheduler& s) {
     if (&s == sched) {
         JLOG("the same destination, skipping teleport <-> " << s.name());
@@ -78,6 +187,7 @@ void Journey::teleport(mt::IScheduler& s) {
 void Journey::handleEvents() {
     if (!eventsAllowed || std::uncaught_exception())
         return;
+    checkDeadline0();
     auto s = gr.reset();
     if (s == ES_NORMAL)
         return;
@@ -94,11 +204,34 @@ void Journey::enableEvents() {
     handleEvents();
 }
 
+bool Journey::eventsEnabled() const {
+    return eventsAllowed;
+}
+
+bool Journey::allowEvents(bool allowed) {
+    std::swap(eventsAllowed, allowed);
+    return allowed;
+}
+
+int64_t Journey::deadline() const {
+    return deadlineNs.load(std::memory_order_relaxed);
+}
+
+// the timer armed for the earlier deadline is cancelled,
+// it's armed again on the next suspension
+void Journey::setDeadline(int64_t ns) {
+    deadlineNs.store(ns, std::memory_order_relaxed);
+    if (armedNs < ns) {
+        deadlineTimer.cancel();
+        armedNs = NO_DEADLINE;
+    }
+}
+
 mt::IScheduler& Journey::scheduler() const {
     return *sched;
 }
 
-int Journey::index() const {
+int64_t Journey::index() const {
     return indx;
 }
 
@@ -106,37 +239,85 @@ Goer Journey::goer() const {
     return gr;
 }
 
-Goer Journey::create(Handler handler, mt::IScheduler& s) {
-    return (new Journey(s))->start0(std::move(handler));
+// the child journey inherits the deadline
+Goer Journey::create(Task handler, mt::IScheduler& s, size_t stackSize) {
+    Journey* j = new Journey(s, stackSize);
+    if (t_journey != nullptr)
+        j->deadlineNs.store(t_journey->deadline(), std::memory_order_relaxed);
+    return j->start0(std::move(handler));
 }
 
 // запуск задачи
-Goer Journey::start0(Handler handler) {
+Goer Journey::start0(Task handler) {
+    // the handler is kept inside the journey: small lambdas below
+    // fit into std::function without allocation
     Goer gr = goer();
-    Handler handlerWarpper = [handler, this] {
-        Handler localHandler = [handler] {
-            //JLOG("started");
-            try
-            {
-                handler();
-            } catch (std::exception& e) {
-                (void) e;
-                JLOG("exception in coro: " << e.what());
-            }
-            //JLOG("ended");
-        };
-
-        guardedCoro0()->start(localHandler);
-    };
-    schedule0(handlerWarpper);
+    task = std::move(handler);
+    schedule0([this] {
+        t_scheduler = sched;
+        guardedCoro0()->start([this] {
+            run0();
+        });
+        runNext0();
+    });
     return gr;
 }
 
+void Journey::run0() {
+    //JLOG("started");
+    try
+    {
+        task();
+    } catch (std::exception& e) {
+        (void) e;
+        JLOG("exception in coro: " << e.what());
+    }
+    // releases the captured state on completion
+    task = nullptr;
+    //JLOG("ended");
+}
+
 void Journey::schedule0(Handler handler) {
     VERIFY(sched != nullptr, "Scheduler must be set in journey");
     sched->schedule(std::move(handler));
 }
 
+void Journey::scheduleProceed0() {
+    schedule0([this] {
+        t_scheduler = sched;
+        proceed0();
+        runNext0();
+    });
+}
+
+// takes the next slot of the current thread, the previous occupant
+// goes to the scheduler queue
+bool Journey::handoff0() {
+    if (t_scheduler != sched || !handoffEnabled.load(std::memory_order_relaxed))
+        return false;
+    Journey* prev = t_next;
+    t_next = this;
+    if (prev != nullptr)
+        prev->scheduleProceed0();
+    return true;
+}
+
+// runs journeys handed off during the step, the current journey
+// may be already destroyed
+void Journey::runNext0() {
+    for (int i = 0; i < HANDOFF_BUDGET && t_next != nullptr; ++ i) {
+        Journey* j = t_next;
+        t_next = nullptr;
+        j->proceed0();
+    }
+    t_scheduler = nullptr;
+    if (t_next != nullptr) {
+        Journey* j = t_next;
+        t_next = nullptr;
+        j->scheduleProceed0();
+    }
+}
+
 Journey::CoroGuard Journey::guardedCoro0() {
     return CoroGuard(*this);
 }
@@ -145,6 +326,28 @@ void Journey::proceed0() {
     guardedCoro0()->resume();
 }
 
+void Journey::checkDeadline0() {
+    int64_t d = deadline();
+    if (d != NO_DEADLINE && nowNs() >= d)
+        gr.timedout();
+}
+
+// the single timer per journey armed for the effective deadline
+// before the suspension: the timeout aborts the pending operation
+void Journey::armDeadline0() {
+    int64_t d = deadline();
+    if (d == NO_DEADLINE || d == armedNs)
+        return;
+    deadlineTimer.cancel();
+    int64_t ms = std::max<int64_t>(0, (d - nowNs() + 999999) / 1000000);
+    deadlineTimer.start(wheel<TimeoutTag>(), static_cast<int>(ms), [this] {
+        // the deadline may be extended after the arming
+        if (nowNs() >= deadline())
+            gr.timedout();
+    });
+    armedNs = d;
+}
+
 void Journey::onEnter0() {
     t_journey = this;
 }
@@ -165,9 +368,13 @@ Journey& journey() {
     return *t_journey;
 }
 
+void enableHandoff(bool enabled) {
+    handoffEnabled = enabled;
+}
+
 void waitForAll() {
     TLOG("waiting for journeys to complete");
-    WAIT_FOR(atomic<JourneyCreateTag>() == atomic<JourneyDestroyTag>());
+    completion().wait();
     TLOG("waiting for journeys completed");
 }
 
@@ -15,6 +15,8 @@
  */
 
 #include "mt.h"
+#include "stack.h"
+#include "pool.h"
 #include "helpers.h"
 
 // ThreadPool log: inside ThreadPool functionality
@@ -48,6 +50,9 @@ std::thread createThread(const Handler& handler, int number, const char* name) {
             (void) e;
             TLOG("thread ended with error: " << e.what());
         }
+        // returns cached coroutine stacks and blocks
+        coro::stackPool().flush();
+        flushPools();
     });
 }
 
@@ -126,3 +131,13 @@ IoService& ThreadPool::ioService() {
 }
 
 }
+
+// threads take the counter slots in turn
+TLS int t_counterSlot = -1;
+
+size_t counterSlot() {
+    static std::atomic<size_t> next(0);
+    if (t_counterSlot < 0)
+        t_counterSlot = static_cast<int>(next++ % ShardedCounter::SLOTS);
+    return t_counterSlot;
+}
@@ -14,8 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <mutex>
+#include <exception>
+
 #include "network.h"
 #include "core.h"
+#include "journey.h"
 
 namespace synca {
 namespace net {
@@ -46,6 +51,22 @@ void deferIo(const CallbackIoHandler& cb) {
     }
 }
 
+// the operation is aborted on cancel or timeout of the journey,
+// the event is thrown after the resumption; the socket abort cancels
+// the operations of other journeys on the socket as well
+void deferIo(const CallbackIoHandler& cb, const Handler& abort) {
+    Error error;
+    deferAbortable([&cb, &error](Handler proceed) {
+        cb([proceed, &error](const Error& e) {
+            error = e;
+            proceed();
+        });
+    }, abort);
+    if (!!error) {
+        throw boost::system::system_error(error, "synca");
+    }
+}
+
 // создает коллбек буффера
 BufferIoHandler bufferIoHandler(Buffer& buffer, const IoHandler& proceed) {
      BufferIoHandler function = [&buffer, proceed](const Error& error, size_t size) {
@@ -67,12 +88,131 @@ BufferIoHandler bufferIoHandler(const IoHandler& proceed) {
 //////////////////////////////////////////////////////////////////
 // Socket class
 //////////////////////////////////////////////////////////////////
+// the output queue: the journey sending the data (writing is set)
+// sends the data queued by the others until the queue is empty
+struct Socket::Output {
+    typedef std::unique_lock<std::mutex> Lock;
+
+    // the writer suspended until its queued data is sent
+    struct Waiter {
+        Handler proceed;
+        std::exception_ptr error;
+        Waiter* next = nullptr;
+    };
+
+    // suspends the writer queued the data, the lock is released
+    void wait(Lock& lock) {
+        Waiter w;
+        w.next = waiters;
+        waiters = &w;
+        lock.release();
+        deferAbortable([this, &w](Handler proceed) {
+            w.proceed = std::move(proceed);
+            mutex.unlock();
+        }, [this, &w] {
+            abort(w);
+        });
+        if (w.error)
+            std::rethrow_exception(w.error);
+    }
+
+    // the interrupted writer is resumed, its data stays queued
+    void abort(Waiter& w) {
+        {
+            Lock lock(mutex);
+            if (!unlink(waiters, w) && !unlink(sending, w))
+                return;
+        }
+        w.proceed();
+    }
+
+    // takes the queued data and its writers for the send,
+    // returns the writers of the data sent before
+    Waiter* next(io::Chain& chain) {
+        Lock lock(mutex);
+        Waiter* sent = sending;
+        sending = nullptr;
+        if (pending.empty()) {
+            writing = false;
+            // the flushing waiters without the data
+            while (waiters) {
+                Waiter* n = waiters->next;
+                waiters->next = sent;
+                sent = waiters;
+                waiters = n;
+            }
+        } else {
+            chain = std::move(pending);
+            pending.clear();
+            sending = waiters;
+            waiters = nullptr;
+        }
+        return sent;
+    }
+
+    // the queued data is dropped, the writers get the send error
+    void fail(const std::exception_ptr& error) {
+        Waiter* w;
+        {
+            Lock lock(mutex);
+            pending.clear();
+            writing = false;
+            while (sending) {
+                Waiter* n = sending->next;
+                sending->next = waiters;
+                waiters = sending;
+                sending = n;
+            }
+            w = waiters;
+            waiters = nullptr;
+        }
+        resume(w, error);
+    }
+
+    static void resume(Waiter* w, const std::exception_ptr& error = nullptr) {
+        while (w) {
+            // the waiter is destroyed after the resumption
+            Waiter* n = w->next;
+            w->error = error;
+            w->proceed();
+            w = n;
+        }
+    }
+
+    static bool unlink(Waiter*& head, Waiter& w) {
+        for (Waiter** p = &head; *p; p = &(*p)->next) {
+            if (*p == &w) {
+                *p = w.next;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::mutex mutex;
+    io::Chain pending;
+    Waiter* waiters = nullptr;      // writers of the pending data
+    Waiter* sending = nullptr;      // writers of the data being sent
+    bool writing = false;
+    int corks = 0;
+    // the error of the send performed on uncork by Cork
+    std::exception_ptr error;
+    std::atomic<int64_t> writes{0};
+    std::atomic<int64_t> sends{0};
+    std::atomic<int64_t> bytes{0};
+};
+
 Socket::Socket() :
-    _socket(service<NetworkTag>()) {
+    _socket(service<NetworkTag>()),
+    _output(new Output) {
 }
 
 Socket::Socket(Socket&& other):
-    _socket(std::move(other._socket)){
+    _socket(std::move(other._socket)),
+    _output(std::move(other._output)) {
+}
+
+Socket::~Socket() {
 }
 
 boost::asio::ip::tcp::socket& Socket::getSocket(){
@@ -89,7 +229,9 @@ void Socket::read(Buffer& buffer) {
                                 boost::asio::buffer(&buffer[0], buffer.size()),
                                 handler);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::partialRead(Buffer& buffer) {
@@ -100,7 +242,9 @@ void Socket::partialRead(Buffer& buffer) {
         _socket.async_read_some(boost::asio::buffer(&buffer[0], buffer.size()),
                                 handler);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::readUntil(Buffer& buffer, const Buffer& stopValue) {
@@ -110,12 +254,15 @@ void Socket::readUntil(Buffer& buffer, const Buffer& stopValue) {
         auto asioBuffer = boost::asio::buffer(&buffer[0], buffer.size());
         
         // условие окончания
-        auto completeCond = [&buffer, stopValue](const boost::system::error_code& error, std::size_t bytes_transferred){
-            bool found = false;
-            if (bytes_transferred >= stopValue.length()) {
-                found = (0 == buffer.compare(bytes_transferred - stopValue.length(), stopValue.length(), stopValue));
-            }
-            return found;
+        size_t scanned = 0;
+        auto completeCond = [&buffer, stopValue, scanned](const boost::system::error_code& error, std::size_t bytes_transferred) mutable {
+            // only the new data is scanned, the delimiter may start
+            // at the end of the previously scanned data
+            size_t overlap = stopValue.empty() ? 0 : stopValue.size() - 1;
+            auto from = buffer.begin() + (scanned > overlap ? scanned - overlap : 0);
+            auto to = buffer.begin() + bytes_transferred;
+            scanned = bytes_transferred;
+            return std::search(from, to, stopValue.begin(), stopValue.end()) != to;
         };
         // запуск чтения из сокета
         boost::asio::async_read(_socket,
@@ -123,10 +270,126 @@ void Socket::readUntil(Buffer& buffer, const Buffer& stopValue) {
                                 completeCond,
                                 handler);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::write(const Buffer& buffer) {
+    write0(buffer);
+}
+
+void Socket::write(const io::Chain& chain) {
+    write0(chain);
+}
+
+// the error of the send performed by another journey: the event
+// of the sending journey aborts the send only
+std::exception_ptr sendError() {
+    try {
+        throw;
+    } catch (EventException&) {
+        return std::make_exception_ptr(boost::system::system_error(
+            boost::asio::error::operation_aborted, "synca"));
+    } catch (...) {
+        return std::current_exception();
+    }
+}
+
+template<typename T_data>
+void Socket::write0(const T_data& data) {
+    Output& o = *_output;
+    ++ o.writes;
+    if (data.size() == 0)
+        return;
+    bool direct;
+    {
+        Output::Lock lock(o.mutex);
+        if (o.corks > 0) {
+            o.pending.append(data);
+            return;
+        }
+        if (o.writing) {
+            o.pending.append(data);
+            o.wait(lock);
+            return;
+        }
+        direct = o.pending.empty();
+        if (!direct)
+            o.pending.append(data);
+        o.writing = true;
+    }
+    try {
+        if (direct)
+            send0(data);
+        flush0();
+    } catch (std::exception&) {
+        o.fail(sendError());
+        throw;
+    }
+}
+
+void Socket::flush() {
+    Output& o = *_output;
+    {
+        Output::Lock lock(o.mutex);
+        if (o.error) {
+            std::exception_ptr error = o.error;
+            o.error = nullptr;
+            std::rethrow_exception(error);
+        }
+        if (o.writing) {
+            // waits for the data queued and sent before
+            o.wait(lock);
+            return;
+        }
+        if (o.pending.empty())
+            return;
+        o.writing = true;
+    }
+    try {
+        flush0();
+    } catch (std::exception&) {
+        o.fail(sendError());
+        throw;
+    }
+}
+
+void Socket::flush0() {
+    Output& o = *_output;
+    while (true) {
+        io::Chain chain;
+        Output::Waiter* sent = o.next(chain);
+        Output::resume(sent);
+        if (chain.empty())
+            return;
+        send0(chain);
+    }
+}
+
+void Socket::cork() {
+    std::lock_guard<std::mutex> lock(_output->mutex);
+    ++ _output->corks;
+}
+
+void Socket::uncork() {
+    if (uncork0())
+        flush();
+}
+
+bool Socket::uncork0() {
+    std::lock_guard<std::mutex> lock(_output->mutex);
+    VERIFY(_output->corks > 0, "Socket is not corked");
+    return -- _output->corks == 0;
+}
+
+WriteStats Socket::writeStats() const {
+    return {_output->writes.load(), _output->sends.load(), _output->bytes.load()};
+}
+
+void Socket::send0(const Buffer& buffer) {
+    ++ _output->sends;
+    _output->bytes += buffer.size();
     CallbackIoHandler callback = [&buffer, this](IoHandler proceed) {
         // коллбек завершения записи
         BufferIoHandler handler = bufferIoHandler(std::move(proceed));
@@ -135,7 +398,67 @@ void Socket::write(const Buffer& buffer) {
                                  boost::asio::buffer(&buffer[0], buffer.size()),
                                  handler);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
+}
+
+typedef std::vector<boost::asio::mutable_buffer> MutableBuffers;
+typedef std::vector<boost::asio::const_buffer> ConstBuffers;
+
+// buffers of the prepared chain regions limited by n bytes
+MutableBuffers prepareBuffers(io::Chain& chain, size_t n) {
+    std::vector<io::Region> regions;
+    chain.prepare(n, regions);
+    MutableBuffers buffers;
+    buffers.reserve(regions.size());
+    for (const io::Region& r: regions) {
+        size_t size = std::min(r.size, n);
+        buffers.push_back(boost::asio::buffer(r.data, size));
+        n -= size;
+    }
+    return buffers;
+}
+
+void Socket::read(io::Chain& chain, size_t n) {
+    MutableBuffers buffers = prepareBuffers(chain, n);
+    deferIo([&chain, &buffers, this](IoHandler proceed) {
+        boost::asio::async_read(_socket, buffers, [&chain, proceed](const Error& error, size_t size) {
+            chain.commit(size);
+            proceed(error);
+        });
+    }, [this] {
+        _socket.cancel();
+    });
+}
+
+size_t Socket::partialRead(io::Chain& chain, size_t maxN) {
+    MutableBuffers buffers = prepareBuffers(chain, maxN);
+    size_t n = 0;
+    deferIo([&chain, &buffers, &n, this](IoHandler proceed) {
+        _socket.async_read_some(buffers, [&chain, &n, proceed](const Error& error, size_t size) {
+            chain.commit(size);
+            n = size;
+            proceed(error);
+        });
+    }, [this] {
+        _socket.cancel();
+    });
+    return n;
+}
+
+void Socket::send0(const io::Chain& chain) {
+    ++ _output->sends;
+    _output->bytes += chain.size();
+    ConstBuffers buffers;
+    buffers.reserve(chain.slices().size());
+    for (const io::Slice& s: chain.slices())
+        buffers.push_back(boost::asio::buffer(s.data(), s.size()));
+    deferIo([&buffers, this](IoHandler proceed) {
+        boost::asio::async_write(_socket, buffers, bufferIoHandler(std::move(proceed)));
+    }, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::connect(const std::string& ip, int port) {
@@ -143,44 +466,227 @@ void Socket::connect(const std::string& ip, int port) {
         EndPoint endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(ip), port);
         _socket.async_connect(endpoint, proceed);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::connect(const EndPoint& e) {
     CallbackIoHandler callback = [&e, this](IoHandler proceed) {
         _socket.async_connect(e, proceed);
     };
-    deferIo(callback);
+    deferIo(callback, [this] {
+        _socket.cancel();
+    });
 }
 
 void Socket::close() {
     _socket.close();
 }
 
+Cork::Cork(Socket& s) : socket(s) {
+    socket.cork();
+}
+
+Cork::~Cork() {
+    // the data stays queued until the next write or flush
+    if (!socket.uncork0() || std::uncaught_exception())
+        return;
+    try {
+        socket.flush();
+    } catch (EventException& e) {
+        // the event is raised on the next suspension
+        Goer goer = journey().goer();
+        if (e.status() == ES_CANCELLED)
+            goer.cancel();
+        else
+            goer.timedout();
+    } catch (std::exception&) {
+        Socket::Output& o = *socket._output;
+        std::lock_guard<std::mutex> lock(o.mutex);
+        o.error = std::current_exception();
+    }
+}
+
+//////////////////////////////////////////////////////////////////
+// StreamReader class
+//////////////////////////////////////////////////////////////////
+StreamReader::StreamReader(Socket& s) : socket(s) {
+}
+
+Buffer StreamReader::readLine(size_t limit) {
+    size_t pos = find0("\n", limit);
+    Buffer line = buffer.split(pos).str();
+    buffer.skip(1);
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return line;
+}
+
+Buffer StreamReader::readUntil(const Buffer& delim, size_t limit) {
+    size_t pos = find0(delim, limit);
+    return buffer.split(pos + delim.size()).str();
+}
+
+Buffer StreamReader::readExactly(size_t n) {
+    io::Chain chain;
+    readExactly(chain, n);
+    return chain.str();
+}
+
+void StreamReader::readExactly(io::Chain& chain, size_t n) {
+    size_t ready = std::min(n, buffer.size());
+    chain.append(buffer.split(ready));
+    if (n > ready)
+        socket.read(chain, n - ready);
+}
+
+Buffer StreamReader::peek(size_t n) {
+    fill0(n);
+    return buffer.str(n);
+}
+
+size_t StreamReader::buffered() const {
+    return buffer.size();
+}
+
+size_t StreamReader::find0(const Buffer& delim, size_t limit) {
+    size_t from = 0;
+    while (true) {
+        size_t pos = buffer.find(delim, from);
+        if (pos != io::Chain::npos)
+            return pos;
+        VERIFY(buffer.size() < limit, "Delimiter is not found within the limit");
+        // the delimiter may start in the scanned tail
+        from = buffer.size() < delim.size() ? 0 : buffer.size() - delim.size() + 1;
+        size_t n = socket.partialRead(buffer);
+        VERIFY(n != 0, "Empty buffer on partial read");
+    }
+}
+
+void StreamReader::fill0(size_t n) {
+    while (buffer.size() < n) {
+        size_t read = socket.partialRead(buffer, std::max(n - buffer.size(), size_t(io::Block::SIZE)));
+        VERIFY(read != 0, "Empty buffer on partial read");
+    }
+}
 
 //////////////////////////////////////////////////////////////////
 // Acceptor class
 //////////////////////////////////////////////////////////////////
 Acceptor::Acceptor(int port) :
-    _acceptor(service<NetworkTag>(),
-              boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(),
-              port)) {
+    Acceptor(port, AcceptorOptions()) {
+}
+
+Acceptor::Acceptor(int port, const AcceptorOptions& options) :
+    _acceptor(service<NetworkTag>()),
+    _options(options) {
+    VERIFY(options.batch > 0, "Batch must be positive");
+    EndPoint endpoint(boost::asio::ip::tcp::v4(), port);
+    _acceptor.open(endpoint.protocol());
+    _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(options.reuseAddress));
+    if (options.reusePort) {
+#ifdef SO_REUSEPORT
+        typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePort;
+        _acceptor.set_option(ReusePort(true));
+#else
+        RAISE("SO_REUSEPORT is not supported");
+#endif
+    }
+    _acceptor.bind(endpoint);
+    _acceptor.listen(options.backlog);
+    // the pending connections are taken by the synchronous accept
+    if (options.batch > 1)
+        _acceptor.non_blocking(true);
 }
 
 Socket Acceptor::accept() {
     Socket socket;
     deferIo([this, &socket](IoHandler proceed) {
         _acceptor.async_accept(socket.getSocket(), proceed);
+    }, [this] {
+        _acceptor.cancel();
     });
+    configure0(socket);
     return socket;
 }
 
+std::vector<Socket> Acceptor::acceptBatch() {
+    std::vector<Socket> sockets;
+    sockets.reserve(_options.batch);
+    sockets.push_back(accept());
+    while (sockets.size() < _options.batch) {
+        Socket socket;
+        Error error;
+        // would_block if there are no pending connections, other
+        // errors are raised by the next accept
+        _acceptor.accept(socket.getSocket(), error);
+        if (!!error)
+            break;
+        configure0(socket);
+        sockets.push_back(std::move(socket));
+    }
+    return sockets;
+}
+
 void Acceptor::goAccept(SocketHandler handler) {
-    std::shared_ptr<Socket> holder(new Socket(accept()));
-    go([holder, handler] {
-        std::weak_ptr<Socket> socketWeak = holder;
-        handler(socketWeak);
-    });
+    mt::IScheduler& s = journey().scheduler();
+    for (Socket& socket: acceptBatch()) {
+        std::shared_ptr<Socket> holder(new Socket(std::move(socket)));
+        go([holder, handler] {
+            std::weak_ptr<Socket> socketWeak = holder;
+            handler(socketWeak);
+        }, s);
+    }
+}
+
+void Acceptor::close() {
+    _acceptor.close();
+}
+
+void Acceptor::configure0(Socket& socket) {
+    boost::asio::ip::tcp::socket& s = socket.getSocket();
+    if (_options.noDelay)
+        s.set_option(boost::asio::ip::tcp::no_delay(true));
+    if (_options.keepAlive)
+        s.set_option(boost::asio::socket_base::keep_alive(true));
+    if (_options.receiveBuffer > 0)
+        s.set_option(boost::asio::socket_base::receive_buffer_size(_options.receiveBuffer));
+    if (_options.sendBuffer > 0)
+        s.set_option(boost::asio::socket_base::send_buffer_size(_options.sendBuffer));
+}
+
+MultiAcceptor::MultiAcceptor(int port, const std::vector<mt::IScheduler*>& schedulers,
+        AcceptorOptions options) :
+    _schedulers(schedulers),
+    _closed(false) {
+    VERIFY(!schedulers.empty(), "Schedulers must be specified");
+    options.reusePort = true;
+    for (size_t i = 0; i < schedulers.size(); ++ i)
+        _acceptors.emplace_back(new Acceptor(port, options));
+}
+
+void MultiAcceptor::serve(SocketHandler handler) {
+    JourneyGroup group;
+    for (size_t i = 0; i < _acceptors.size(); ++ i) {
+        Acceptor& acceptor = *_acceptors[i];
+        group.go([this, &acceptor, handler] {
+            try {
+                while (true)
+                    acceptor.goAccept(handler);
+            } catch (std::exception&) {
+                if (!_closed)
+                    throw;
+            }
+        }, *_schedulers[i]);
+    }
+    group.wait();
+}
+
+void MultiAcceptor::close() {
+    _closed = true;
+    for (auto&& acceptor: _acceptors)
+        acceptor->close();
 }
 
 Resolver::Resolver() :
@@ -197,6 +703,8 @@ EndPoints Resolver::resolve(const std::string& hostname, int port) {
             }
             proceed(e);
         });
+    }, [this] {
+        _resolver.cancel();
     });
     return ends;
 }
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pool.h"
+
+TLS PoolFlusher* t_flushers = nullptr;
+
+void registerPoolFlusher(PoolFlusher& flusher) {
+    flusher.next = t_flushers;
+    t_flushers = &flusher;
+}
+
+void flushPools() {
+    while (t_flushers != nullptr) {
+        PoolFlusher* flusher = t_flushers;
+        t_flushers = flusher->next;
+        flusher->flush();
+        flusher->flush = nullptr;
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "select.h"
+#include "helpers.h"
+
+namespace synca {
+
+const int TIMEOUT_INDEX = -2;
+const int ABORTED_INDEX = -3;
+
+// Shared with the timer handler. The journey is proceeded when both
+// the fired case and the registration release their holds, so the journey
+// cannot be resumed while the registration is in progress.
+struct Select::State {
+    State() : selected(-1), holds(2) {}
+
+    bool claim(int index) {
+        int none = -1;
+        return selected.compare_exchange_strong(none, index);
+    }
+
+    void release() {
+        if (holds.fetch_sub(1) == 1)
+            proceed();
+    }
+
+    std::atomic<int> selected;
+    std::atomic<int> holds;
+    Handler proceed;
+};
+
+struct Select::Timer {
+    WheelTimer timer;
+};
+
+Select::Select() :
+    state(std::make_shared<State>()),
+    timeoutMs(-1),
+    fired(false),
+    okValue(false) {
+}
+
+Select::~Select() {
+}
+
+Select& Select::timeout(int ms) {
+    timeoutMs = ms;
+    return *this;
+}
+
+size_t Select::wait() {
+    size_t i = tryWait();
+    if (i != NONE)
+        return i;
+    VERIFY(!cases.empty() || timeoutMs >= 0, "Select without cases and timeout");
+    try {
+        deferAbortable([this](Handler proceed) {
+            state->proceed = std::move(proceed);
+            enlist0();
+            state->release();
+        }, [this] {
+            // the case completes the select unless it's already claimed
+            if (state->claim(ABORTED_INDEX))
+                state->release();
+        });
+    } catch (...) {
+        // the waiters of the cases must not outlive the select
+        finish0();
+        throw;
+    }
+    finish0();
+    int selected = state->selected;
+    if (selected == TIMEOUT_INDEX)
+        return TIMEDOUT;
+    if (!fired)
+        okValue = cases[selected]->completed();
+    return selected;
+}
+
+size_t Select::tryWait() {
+    for (size_t i = 0; i < cases.size(); ++ i) {
+        ISelectCase& c = *cases[i];
+        bool ready;
+        {
+            std::lock_guard<std::mutex> lock(c.mutex());
+            ready = c.tryFire(okValue);
+        }
+        if (ready) {
+            c.complete();
+            return i;
+        }
+    }
+    return NONE;
+}
+
+bool Select::ok() const {
+    return okValue;
+}
+
+// All channels are locked in the address order to avoid deadlocks: nobody
+// may claim the select while the cases are checked and registered.
+void Select::enlist0() {
+    std::vector<std::mutex*> mutexes;
+    for (auto& c: cases)
+        mutexes.push_back(&c->mutex());
+    std::sort(mutexes.begin(), mutexes.end());
+    mutexes.erase(std::unique(mutexes.begin(), mutexes.end()), mutexes.end());
+    for (std::mutex* m: mutexes)
+        m->lock();
+    int index = -1;
+    for (size_t i = 0; i < cases.size(); ++ i) {
+        if (cases[i]->tryFire(okValue)) {
+            index = static_cast<int>(i);
+            break;
+        }
+    }
+    if (index >= 0) {
+        state->claim(index);
+        fired = true;
+    } else {
+        State* s = state.get();
+        for (size_t i = 0; i < cases.size(); ++ i) {
+            cases[i]->enlist(state->selected, static_cast<int>(i), [s] {
+                s->release();
+            });
+        }
+    }
+    for (std::mutex* m: mutexes)
+        m->unlock();
+    if (fired) {
+        cases[index]->complete();
+        state->release();
+    } else if (timeoutMs >= 0) {
+        startTimer0();
+    }
+}
+
+void Select::finish0() {
+    for (auto& c: cases)
+        c->delist();
+    if (timer)
+        timer->timer.cancel();
+}
+
+void Select::startTimer0() {
+    timer.reset(new Timer);
+    std::shared_ptr<State> s = state;
+    timer->timer.start(wheel<TimeoutTag>(), timeoutMs, [s] {
+        if (s->claim(TIMEOUT_INDEX))
+            s->release();
+    });
+}
+
+}
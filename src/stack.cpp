@@ -0,0 +1,289 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef flagMMAP_STACK
+#   include <unistd.h>
+#   include <sys/mman.h>
+#endif
+
+#include "stack.h"
+#include "helpers.h"
+
+namespace coro {
+
+// free stack header is placed into the stack memory itself
+struct StackNode {
+    StackNode* next;
+    size_t size;
+};
+
+// thread local free lists
+TLS StackNode* t_stacks[STACK_CLASSES];
+TLS size_t t_stacksCount[STACK_CLASSES];
+
+#ifdef flagMMAP_STACK
+
+size_t pageSize0() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+// reserves the stack with the guard page below it, pages are committed lazily
+Stack allocate0(size_t size) {
+    size_t page = pageSize0();
+    size_t total = size + page;
+    int flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    void* region = mmap(nullptr, total, PROT_READ | PROT_WRITE, flags, -1, 0);
+    VERIFY(region != MAP_FAILED, "Cannot map coroutine stack");
+    if (mprotect(region, page, PROT_NONE) != 0) {
+        munmap(region, total);
+        RAISE("Cannot protect coroutine stack guard page");
+    }
+    Stack s;
+    s.ptr = static_cast<char*>(region) + page;
+    s.size = size;
+    return s;
+}
+
+void deallocate0(Stack& s) {
+    size_t page = pageSize0();
+    munmap(static_cast<char*>(s.ptr) - page, s.size + page);
+    s.ptr = nullptr;
+    s.size = 0;
+}
+
+// releases resident pages except the top one containing the node
+void decommit0(StackNode* node) {
+    size_t page = pageSize0();
+    char* ptr = reinterpret_cast<char*>(node) + sizeof(StackNode) - node->size;
+    if (node->size > page)
+        madvise(ptr, node->size - page, MADV_DONTNEED);
+}
+
+#else
+
+Stack allocate0(size_t size) {
+    Stack s;
+    s.ptr = new unsigned char[size];
+    s.size = size;
+    return s;
+}
+
+void deallocate0(Stack& s) {
+    delete [] static_cast<unsigned char*>(s.ptr);
+    s.ptr = nullptr;
+    s.size = 0;
+}
+
+void decommit0(StackNode* node) {
+}
+
+#endif
+
+// the node is placed on the top to keep the bottom pages untouched
+StackNode* toNode0(const Stack& s) {
+    StackNode* node = reinterpret_cast<StackNode*>(static_cast<char*>(s.top()) - sizeof(StackNode));
+    node->size = s.size;
+    return node;
+}
+
+Stack toStack0(StackNode* node) {
+    Stack s;
+    s.size = node->size;
+    s.ptr = reinterpret_cast<char*>(node) + sizeof(StackNode) - node->size;
+    return s;
+}
+
+// stack size class: STACK_MIN_SIZE << class
+size_t sizeClass0(size_t size) {
+    size_t cls = 0;
+    while ((STACK_MIN_SIZE << cls) < size)
+        ++ cls;
+    VERIFY(cls < STACK_CLASSES, "Stack size is too large");
+    return cls;
+}
+
+const char PAINT_VALUE = '\xA5';
+
+void paint(Stack& stack) {
+    std::memset(stack.ptr, PAINT_VALUE, stack.size);
+}
+
+size_t usage(const Stack& stack) {
+    const char* ptr = static_cast<const char*>(stack.ptr);
+    size_t untouched = 0;
+    while (untouched < stack.size && ptr[untouched] == PAINT_VALUE)
+        ++ untouched;
+    return stack.size - untouched;
+}
+
+StackPool::StackPool() :
+    capacity(1024),
+    lowWatermark(16),
+    highWatermark(64),
+    hitCount(0),
+    missCount(0) {
+    for (size_t cls = 0; cls < STACK_CLASSES; ++ cls) {
+        roots[cls] = nullptr;
+        counts[cls] = 0;
+    }
+}
+
+StackPool::~StackPool() {
+    for (size_t cls = 0; cls < STACK_CLASSES; ++ cls)
+        release0(roots[cls]);
+}
+
+Stack StackPool::allocate(size_t size) {
+    size_t cls = sizeClass0(size);
+    if (t_stacks[cls] == nullptr)
+        refill0(cls);
+    StackNode* node = t_stacks[cls];
+    if (node == nullptr) {
+        missCount.fetch_add(1, std::memory_order_relaxed);
+        return allocate0(STACK_MIN_SIZE << cls);
+    }
+    t_stacks[cls] = node->next;
+    -- t_stacksCount[cls];
+    hitCount.fetch_add(1, std::memory_order_relaxed);
+    return toStack0(node);
+}
+
+void StackPool::deallocate(Stack& stack) {
+    if (stack.ptr == nullptr)
+        return;
+    size_t cls = sizeClass0(stack.size);
+    StackNode* node = toNode0(stack);
+    node->next = t_stacks[cls];
+    t_stacks[cls] = node;
+    ++ t_stacksCount[cls];
+    stack = Stack();
+    if (t_stacksCount[cls] >= highWatermark)
+        trim0(cls);
+}
+
+void StackPool::flush() {
+    for (size_t cls = 0; cls < STACK_CLASSES; ++ cls) {
+        StackNode* list = t_stacks[cls];
+        t_stacks[cls] = nullptr;
+        t_stacksCount[cls] = 0;
+        put0(cls, list);
+    }
+}
+
+// must be set up before journeys creation
+void StackPool::setCapacity(size_t capacity_) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = capacity_;
+}
+
+// must be set up before journeys creation
+void StackPool::setWatermarks(size_t low, size_t high) {
+    VERIFY(low < high, "Low watermark must be less than high watermark");
+    std::lock_guard<std::mutex> lock(mutex);
+    lowWatermark = low;
+    highWatermark = high;
+}
+
+size_t StackPool::hits() const {
+    return hitCount.load(std::memory_order_relaxed);
+}
+
+size_t StackPool::misses() const {
+    return missCount.load(std::memory_order_relaxed);
+}
+
+size_t StackPool::cached() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (size_t cls = 0; cls < STACK_CLASSES; ++ cls)
+        count += counts[cls];
+    return count;
+}
+
+// takes up to low watermark stacks from the global pool
+void StackPool::refill0(size_t cls) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t n = std::max<size_t>(lowWatermark, 1);
+    StackNode*& root = roots[cls];
+    while (root != nullptr && t_stacksCount[cls] < n) {
+        StackNode* node = root;
+        root = root->next;
+        -- counts[cls];
+        node->next = t_stacks[cls];
+        t_stacks[cls] = node;
+        ++ t_stacksCount[cls];
+    }
+}
+
+// moves excess stacks down to low watermark into the global pool
+void StackPool::trim0(size_t cls) {
+    StackNode* list = nullptr;
+    while (t_stacksCount[cls] > lowWatermark) {
+        StackNode* node = t_stacks[cls];
+        t_stacks[cls] = node->next;
+        -- t_stacksCount[cls];
+        node->next = list;
+        list = node;
+    }
+    put0(cls, list);
+}
+
+// puts the list into the global pool, the rest goes to the system
+void StackPool::put0(size_t cls, StackNode* list) {
+    for (StackNode* node = list; node != nullptr; node = node->next)
+        decommit0(node);
+    StackNode* excess = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (list != nullptr) {
+            StackNode* node = list;
+            list = list->next;
+            if (counts[cls] < capacity) {
+                node->next = roots[cls];
+                roots[cls] = node;
+                ++ counts[cls];
+            } else {
+                node->next = excess;
+                excess = node;
+            }
+        }
+    }
+    release0(excess);
+}
+
+void StackPool::release0(StackNode* list) {
+    while (list != nullptr) {
+        Stack s = toStack0(list);
+        list = list->next;
+        deallocate0(s);
+    }
+}
+
+StackPool& stackPool() {
+    return single<StackPool>();
+}
+
+}
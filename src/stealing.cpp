@@ -0,0 +1,332 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stealing.h"
+#include "pool.h"
+#include "helpers.h"
+
+// ThreadPool log: inside ThreadPool functionality
+#define PLOG(D_msg)             TLOG("@" << this->name() << ": " << D_msg)
+
+namespace mt {
+
+const int64_t DEQUE_CAPACITY = 256;
+// steal attempts before parking
+const int SPIN_COUNT = 64;
+// local jobs between checks of the injection queue and the network
+const uint32_t POLL_INTERVAL = 61;
+
+struct Job : Pooled<Job> {
+    explicit Job(Handler handler_) : handler(std::move(handler_)) {}
+
+    Handler handler;
+};
+
+// current worker
+TLS WorkStealingPool* t_pool = nullptr;
+TLS size_t t_index = 0;
+
+struct WorkDeque::Array {
+    explicit Array(int64_t capacity) :
+        mask(capacity - 1),
+        items(new std::atomic<Job*>[capacity]) {
+    }
+
+    int64_t capacity() const {
+        return mask + 1;
+    }
+
+    Job* get(int64_t i) const {
+        return items[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, Job* job) {
+        items[i & mask].store(job, std::memory_order_relaxed);
+    }
+
+    int64_t mask;
+    std::unique_ptr<std::atomic<Job*>[]> items;
+};
+
+WorkDeque::WorkDeque() :
+    top(0),
+    bottom(0),
+    array(new Array(DEQUE_CAPACITY)) {
+}
+
+WorkDeque::~WorkDeque() {
+    for (Array* a: retired)
+        delete a;
+    delete array.load(std::memory_order_relaxed);
+}
+
+void WorkDeque::push(Job* job) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array* a = array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity() - 1)
+        a = grow0(a, t, b);
+    a->put(b, job);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Job* WorkDeque::take() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job* job = a->get(b);
+    if (t == b) {
+        // the last item: races with thieves
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+// returns nullptr if the deque is empty or the race is lost
+Job* WorkDeque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return nullptr;
+    Array* a = array.load(std::memory_order_acquire);
+    Job* job = a->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+bool WorkDeque::empty() const {
+    int64_t t = top.load(std::memory_order_acquire);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    return t >= b;
+}
+
+// old arrays may still be read by thieves, so they are kept until destruction
+WorkDeque::Array* WorkDeque::grow0(Array* a, int64_t t, int64_t b) {
+    Array* grown = new Array(a->capacity() * 2);
+    for (int64_t i = t; i < b; ++ i)
+        grown->put(i, a->get(i));
+    retired.push_back(a);
+    array.store(grown, std::memory_order_release);
+    return grown;
+}
+
+struct WorkStealingPool::Worker {
+    explicit Worker(size_t index_) :
+        index(index_),
+        seed(static_cast<uint32_t>(index_) * 2654435761u + 1),
+        tick(0) {
+    }
+
+    // xorshift to choose the victim
+    uint32_t random() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    WorkDeque deque;
+    size_t index;
+    uint32_t seed;
+    uint32_t tick;
+};
+
+WorkStealingPool::WorkStealingPool(size_t threadCount, const char* name) :
+    _tpName(name),
+    _injectedCount(0),
+    _spinning(0),
+    _sleepers(0),
+    _waiters(0),
+    _toStop(false) {
+
+    VERIFY(threadCount > 0, "Thread pool must contain threads");
+    _work.reset(new Work(_service));
+    _workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++ i)
+        _workers.emplace_back(new Worker(i));
+    _threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++ i) {
+        Worker& w = *_workers[i];
+        _threads.emplace_back(createThread([this, &w] {
+            run0(w);
+        }, i, _tpName));
+    }
+    PLOG("work stealing pool created with threads: " << threadCount);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    // workers drain the jobs and exit when the network is done
+    _toStop = true;
+    _work.reset();
+    PLOG("join threads in pool");
+    for (size_t i = 0; i < _threads.size(); ++ i)
+        _threads[i].join();
+    for (Job* job: _injected)
+        delete job;
+    PLOG("work stealing pool stopped");
+}
+
+void WorkStealingPool::schedule(Handler handler) {
+    Job* job = new Job(std::move(handler));
+    if (t_pool == this) {
+        _workers[t_index]->deque.push(job);
+    } else {
+        std::lock_guard<std::mutex> lock(_injectMutex);
+        _injected.push_back(job);
+        _injectedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    // pairs with the fence in park0: either the parking worker sees the job
+    // or the job sees the parking worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_spinning.load(std::memory_order_relaxed) == 0 && _sleepers.load(std::memory_order_relaxed) > 0)
+        wake0();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    ++ _waiters;
+    _cond.wait(lock, [this] {
+        return _sleepers.load() == _workers.size() && !hasJobs0();
+    });
+    -- _waiters;
+}
+
+const char* WorkStealingPool::name() const {
+    return _tpName;
+}
+
+IoService& WorkStealingPool::ioService() {
+    return _service;
+}
+
+void WorkStealingPool::run0(Worker& w) {
+    t_pool = this;
+    t_index = w.index;
+    while (true) {
+        Job* job = find0(w);
+        if (job == nullptr && _service.poll_one() > 0)
+            continue;
+        if (job == nullptr)
+            job = spin0(w);
+        if (job != nullptr) {
+            execute0(job);
+            continue;
+        }
+        if (_toStop)
+            break;
+        park0();
+    }
+    t_pool = nullptr;
+}
+
+Job* WorkStealingPool::find0(Worker& w) {
+    // avoids starvation of the injection queue and the network
+    if (++ w.tick % POLL_INTERVAL == 0) {
+        _service.poll_one();
+        if (Job* job = takeInjected0())
+            return job;
+    }
+    if (Job* job = w.deque.take())
+        return job;
+    return steal0(w);
+}
+
+Job* WorkStealingPool::steal0(Worker& w) {
+    if (Job* job = takeInjected0())
+        return job;
+    size_t count = _workers.size();
+    size_t start = w.random() % count;
+    for (size_t i = 0; i < count; ++ i) {
+        size_t victim = (start + i) % count;
+        if (victim == w.index)
+            continue;
+        if (Job* job = _workers[victim]->deque.steal())
+            return job;
+    }
+    return nullptr;
+}
+
+Job* WorkStealingPool::spin0(Worker& w) {
+    _spinning.fetch_add(1);
+    Job* job = nullptr;
+    for (int i = 0; i < SPIN_COUNT && job == nullptr && !_toStop; ++ i) {
+        std::this_thread::yield();
+        job = steal0(w);
+    }
+    _spinning.fetch_sub(1);
+    return job;
+}
+
+Job* WorkStealingPool::takeInjected0() {
+    if (_injectedCount.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(_injectMutex);
+    if (_injected.empty())
+        return nullptr;
+    Job* job = _injected.front();
+    _injected.pop_front();
+    _injectedCount.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+}
+
+bool WorkStealingPool::hasJobs0() const {
+    if (_injectedCount.load() > 0)
+        return true;
+    for (auto& w: _workers)
+        if (!w->deque.empty())
+            return true;
+    return false;
+}
+
+// sleeps until the network completion or the wake up
+void WorkStealingPool::park0() {
+    _sleepers.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cond.notify_all();
+    }
+    if (!hasJobs0())
+        _service.run_one();
+    _sleepers.fetch_sub(1);
+}
+
+void WorkStealingPool::wake0() {
+    _service.post([] {});
+}
+
+void WorkStealingPool::execute0(Job* job) {
+    std::unique_ptr<Job> guard(job);
+    try {
+        job->handler();
+    } catch (std::exception& e) {
+        (void) e;
+        PLOG("job ended with error: " << e.what());
+    }
+}
+
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+#include "wheel.h"
+#include "core.h"
+#include "helpers.h"
+
+namespace synca {
+
+typedef boost::system::error_code Error;
+
+// the timer whose handler is invoked by the current thread
+thread_local WheelTimer* t_firing = nullptr;
+
+// the wheel of the threads sharing the counter slot, padded
+// to avoid false sharing between the neighbours
+struct TimerWheel::Wheel {
+    std::mutex mutex;
+    std::unique_ptr<WheelTimer*[]> buckets;
+    size_t pos = 0;
+    std::atomic<size_t> count{0};
+    // expired timers of the current tick to be fired
+    WheelTimer* expired = nullptr;
+    char pad[64];
+};
+
+// Drives the wheels while there are armed timers. The ticker destroyed
+// without the last tick (the service is stopped) releases the ticking.
+struct TimerWheel::Ticker {
+    Ticker(TimerWheel& w, mt::IoService& s) : wheel(w), timer(s) {}
+
+    ~Ticker() {
+        if (!stopped)
+            wheel.ticking = false;
+    }
+
+    static void start(const std::shared_ptr<Ticker>& t) {
+        t->timer.expires_from_now(boost::posix_time::milliseconds(t->wheel.tickMs));
+        wait0(t);
+    }
+
+private:
+    static void wait0(const std::shared_ptr<Ticker>& t) {
+        t->timer.async_wait([t](const Error& error) {
+            t->onTick0(t, error);
+        });
+    }
+
+    void onTick0(const std::shared_ptr<Ticker>& t, const Error& error) {
+        if (!error && wheel.advance0()) {
+            // absolute expiration: the ticker doesn't drift
+            timer.expires_at(timer.expires_at() + boost::posix_time::milliseconds(wheel.tickMs));
+            wait0(t);
+            return;
+        }
+        stopped = true;
+        wheel.ticking = false;
+        // pairs with the fence in arm0: the timer armed after
+        // the last tick restarts the ticker
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (wheel.armed0() && !wheel.ticking.exchange(true))
+            wheel.startTicker0();
+    }
+
+    TimerWheel& wheel;
+    boost::asio::deadline_timer timer;
+    bool stopped = false;
+};
+
+TimerWheel::TimerWheel(Service& s) :
+    service(s),
+    wheels(new Wheel[ShardedCounter::SLOTS]),
+    ticking(false),
+    tickMs(DEFAULT_TICK_MS) {
+}
+
+TimerWheel::~TimerWheel() {
+}
+
+void TimerWheel::setTick(int ms) {
+    VERIFY(ms > 0, "Tick must be positive");
+    tickMs = ms;
+}
+
+int TimerWheel::tick() const {
+    return tickMs;
+}
+
+void TimerWheel::arm0(WheelTimer& t, int ms) {
+    // verifies the service is attached before arming
+    mt::IoService& s = service;
+    // the next tick comes in less than the tick: it's not counted
+    size_t ticks = ms <= 0 ? 1 : (ms + tickMs - 1) / tickMs + 1;
+    Wheel& w = wheels[counterSlot()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.buckets) {
+            w.buckets.reset(new WheelTimer*[BUCKETS]);
+            std::fill(w.buckets.get(), w.buckets.get() + BUCKETS, nullptr);
+        }
+        t.wheel = &w;
+        t.bucket = (w.pos + ticks) % BUCKETS;
+        t.rounds = (ticks - 1) / BUCKETS;
+        t.prev = nullptr;
+        t.next = w.buckets[t.bucket];
+        if (t.next)
+            t.next->prev = &t;
+        w.buckets[t.bucket] = &t;
+        t.state = WheelTimer::TS_ARMED;
+        ++ w.count;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!ticking.load(std::memory_order_relaxed) && !ticking.exchange(true))
+        Ticker::start(std::make_shared<Ticker>(*this, s));
+}
+
+// The expired timer is cancelled until its handler is invoked. The handler
+// cancelling its own timer doesn't wait for itself.
+bool TimerWheel::cancel0(WheelTimer& t) {
+    Wheel& w = *t.wheel;
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        switch (t.state.load()) {
+        case WheelTimer::TS_ARMED:
+            if (t.prev)
+                t.prev->next = t.next;
+            else
+                w.buckets[t.bucket] = t.next;
+            if (t.next)
+                t.next->prev = t.prev;
+            -- w.count;
+            t.state = WheelTimer::TS_IDLE;
+            return true;
+
+        case WheelTimer::TS_EXPIRED:
+            if (t.prev)
+                t.prev->next = t.next;
+            else
+                w.expired = t.next;
+            if (t.next)
+                t.next->prev = t.prev;
+            t.state = WheelTimer::TS_IDLE;
+            return true;
+
+        case WheelTimer::TS_FIRING:
+            if (&t != t_firing)
+                break;
+            // the timer may be destroyed or restarted by the handler
+            t_firing = nullptr;
+            t.state = WheelTimer::TS_IDLE;
+            return false;
+
+        default:
+            return false;
+        }
+    }
+    while (t.state.load(std::memory_order_acquire) == WheelTimer::TS_FIRING)
+        std::this_thread::yield();
+    return false;
+}
+
+void TimerWheel::startTicker0() {
+    mt::IoService& s = service;
+    Ticker::start(std::make_shared<Ticker>(*this, s));
+}
+
+// Expired timers are moved to the expired list under the wheel lock and
+// their handlers are invoked one by one after the unlock: the handler may
+// arm the timers or cancel the expired timers which are not fired yet.
+bool TimerWheel::advance0() {
+    for (size_t i = 0; i < ShardedCounter::SLOTS; ++ i) {
+        Wheel& w = wheels[i];
+        if (w.count.load() == 0)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.pos = (w.pos + 1) % BUCKETS;
+            WheelTimer* t = w.buckets[w.pos];
+            while (t) {
+                WheelTimer* next = t->next;
+                if (t->rounds > 0) {
+                    -- t->rounds;
+                } else {
+                    if (t->prev)
+                        t->prev->next = next;
+                    else
+                        w.buckets[w.pos] = next;
+                    if (next)
+                        next->prev = t->prev;
+                    -- w.count;
+                    t->state = WheelTimer::TS_EXPIRED;
+                    t->prev = nullptr;
+                    t->next = w.expired;
+                    if (w.expired)
+                        w.expired->prev = t;
+                    w.expired = t;
+                }
+                t = next;
+            }
+        }
+        fire0(w);
+    }
+    return armed0();
+}
+
+void TimerWheel::fire0(Wheel& w) {
+    while (true) {
+        WheelTimer* t;
+        Task handler;
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            t = w.expired;
+            if (t == nullptr)
+                return;
+            w.expired = t->next;
+            if (w.expired)
+                w.expired->prev = nullptr;
+            t->state = WheelTimer::TS_FIRING;
+            handler = std::move(t->handler);
+        }
+        t_firing = t;
+        handler();
+        // the timer may be destroyed right after the state change,
+        // the timer cancelled by its handler is already idle
+        if (t_firing == t)
+            t->state.store(WheelTimer::TS_IDLE, std::memory_order_release);
+        t_firing = nullptr;
+    }
+}
+
+bool TimerWheel::armed0() const {
+    for (size_t i = 0; i < ShardedCounter::SLOTS; ++ i)
+        if (wheels[i].count.load() > 0)
+            return true;
+    return false;
+}
+
+WheelTimer::WheelTimer() : state(TS_IDLE) {
+}
+
+WheelTimer::~WheelTimer() {
+    cancel();
+}
+
+void WheelTimer::start(TimerWheel& w, int ms, Task h) {
+    VERIFY(state.load() == TS_IDLE, "Timer is already armed");
+    handler = std::move(h);
+    w.arm0(*this, ms);
+    owner = &w;
+}
+
+bool WheelTimer::cancel() {
+    if (owner == nullptr)
+        return false;
+    bool cancelled = owner->cancel0(*this);
+    if (cancelled)
+        handler = nullptr;
+    return cancelled;
+}
+
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// separate binary: the global operator new is replaced to count
+// the allocations, the other tests use the default allocator
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "core.h"
+#include "helpers.h"
+
+namespace bench {
+
+using namespace mt;
+using namespace synca;
+
+const char* BENCH_POOL = "bench";
+
+// counts heap allocations inside the benchmark thread pool only
+std::atomic<size_t>& allocations()
+{
+    static std::atomic<size_t> counter(0);
+    return counter;
+}
+
+void countAllocation()
+{
+    if (std::strcmp(mt::name(), BENCH_POOL) == 0)
+        allocations().fetch_add(1, std::memory_order_relaxed);
+}
+
+// each journey spawns the next one: steady state of journeys creation
+void spawnChain(IScheduler& s, int n)
+{
+    go([&s, n] {
+        if (n > 0)
+            spawnChain(s, n - 1);
+    }, s);
+}
+
+void alloc1()
+{
+    const int WARMUP = 1000;
+    const int JOURNEYS = 100000;
+
+    ThreadPool tp(1, BENCH_POOL);
+    go([&tp] {
+        spawnChain(tp, WARMUP);
+    }, tp);
+    waitForAll();
+    size_t before = allocations();
+    go([&tp] {
+        spawnChain(tp, JOURNEYS);
+    }, tp);
+    waitForAll();
+    size_t allocs = allocations() - before;
+    RLOG("journeys: " << JOURNEYS << ", allocations: " << allocs
+        << ", per journey: " << double(allocs) / JOURNEYS);
+}
+
+}
+
+void* operator new(size_t size)
+{
+    bench::countAllocation();
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+int main()
+{
+    try
+    {
+        bench::alloc1();
+    }
+    catch (std::exception& e)
+    {
+        RLOG("Error: " << e.what());
+        return 1;
+    }
+    RLOG("main ended");
+    return 0;
+}
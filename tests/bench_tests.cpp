@@ -0,0 +1,113 @@
+/*
+ * Copyright 2014 Grigory Demchenko (aka gridem)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_tests.h"
+#include "core.h"
+#include "channel.h"
+#include "ring_channel.h"
+#include "stealing.h"
+#include "helpers.h"
+
+namespace bench {
+
+using namespace mt;
+using namespace synca;
+
+// relay ring: values passed through the ring per second
+template<typename T_channel>
+void ring(IScheduler& s, int seconds, size_t capacity)
+{
+    std::vector<std::unique_ptr<T_channel>> channels;
+    for (int i = 0; i < 4; ++ i)
+        channels.emplace_back(new T_channel(capacity));
+    auto& chFirst = *channels.front();
+    auto& chLast = *channels.back();
+    for (int i = 0; i < 10000; ++ i)
+        chFirst.put(1);
+
+    std::atomic<int> counter(0);
+    for (size_t i = 0; i < channels.size() - 1; ++ i)
+    {
+        auto& ch = *channels[i];
+        auto& chNext = *channels[i+1];
+        go([&ch, &chNext] {
+            for (int v: ch)
+                chNext.put(v);
+        }, s, 1024*8);
+    }
+    go([&chFirst, &chLast, &counter] {
+        for (int v: chLast)
+        {
+            counter.fetch_add(1, std::memory_order_relaxed);
+            chFirst.put(v);
+        }
+    }, s, 1024*8);
+    for (int i = 0; i < seconds; ++ i)
+    {
+        int before = counter;
+        sleepFor(1000);
+        RLOG(s.name() << " counted: " << counter - before);
+    }
+    for (auto& ch: channels)
+        ch->close();
+    waitForAll();
+}
+
+void ring(IScheduler& s, int seconds)
+{
+    ring<Channel<int>>(s, seconds, Channel<int>::UNBOUNDED);
+}
+
+// runs the ring without and with the direct handoff
+void handoffRing(IScheduler& s, int seconds)
+{
+    RLOG(s.name() << " queued resume");
+    ring(s, seconds);
+    RLOG(s.name() << " direct handoff");
+    enableHandoff();
+    ring(s, seconds);
+    enableHandoff(false);
+}
+
+void cycle1()
+{
+    const int SECONDS = 3;
+    int threads = std::thread::hardware_concurrency();
+    {
+        ThreadPool tp(threads, "tp");
+        handoffRing(tp, SECONDS);
+    }
+    {
+        WorkStealingPool wsp(threads, "wsp");
+        handoffRing(wsp, SECONDS);
+    }
+}
+
+
+// the same ring using mutex and lock-free channels
+void cycle2()
+{
+    const int SECONDS = 3;
+    const size_t CAPACITY = 1024*16;
+    int threads = std::thread::hardware_concurrency();
+    ThreadPool tp(threads, "tp");
+    RLOG("mutex channel");
+    ring<Channel<int>>(tp, SECONDS, CAPACITY);
+    RLOG("ring channel");
+    ring<RingChannel<int>>(tp, SECONDS, CAPACITY);
+}
+}
+
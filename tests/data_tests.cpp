@@ -16,6 +16,8 @@
 
 #include "data.h"
 #include "channel.h"
+#include "ring_channel.h"
+#include "select.h"
 #include "mt.h"
 #include "helpers.h"
 
@@ -132,6 +134,260 @@ void pipe4()
     TLOG("v: " << v);
 }
 
+void pipe5()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    Channel<int> c;
+    Channel<int> aggr;
+    piping1toManyBatch(c, aggr, [](int v, Batch<int>& dst) {
+        dst.put(v - 1);
+        dst.put(v - 2);
+    });
+    std::vector<int> vs;
+    piping1toManyBatch(aggr, c, [&vs](int v, Batch<int>& dst) {
+        vs.push_back(v);
+        if (v > 0)
+            dst.put(v);
+    });
+    RTLOG("starting");
+    c.put(25);
+    closeAndWait(tp, c);
+    RTLOG("completed, size: " << vs.size());
+}
+
+void bounded1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    Channel<int> c(2);
+    go([&c] {
+        for (int i = 0; i < 10; ++ i)
+        {
+            c.put(i);
+            JLOG("put: " << i);
+        }
+        c.close();
+    });
+    go([&c] {
+        for (int v: c)
+        {
+            JLOG("got: " << v);
+            sleepFor(10);
+        }
+    });
+    waitForAll();
+    // blocked sender is woken up on close
+    Channel<int> full(1);
+    go([&full] {
+        full.put(1);
+        bool put = full.put(2);
+        JLOG("put on closed: " << put);
+    });
+    sleepFor(100);
+    full.close();
+    waitForAll();
+    TLOG("remained: " << full.get());
+}
+
+void rendezvous1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    Channel<int> c(0);
+    go([&c] {
+        for (int i = 0; i < 3; ++ i)
+        {
+            c.put(i);
+            JLOG("taken: " << i);
+        }
+        c.close();
+    });
+    go([&c] {
+        for (int v: c)
+        {
+            JLOG("got: " << v);
+            sleepFor(50);
+        }
+    });
+    waitForAll();
+}
+
+void batch1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    Channel<int> c(8);
+    go([&c] {
+        std::vector<int> vs;
+        for (int i = 0; i < 20; ++ i)
+            vs.push_back(i);
+        // the rest above the capacity is put one by one
+        c.putMany(vs);
+        JLOG("put: " << vs.size());
+        c.close();
+    });
+    go([&c] {
+        std::vector<int> vs;
+        size_t n = c.getMany(vs, 5);
+        JLOG("got batch: " << n);
+        for (int v: drain(c, 4))
+            vs.push_back(v);
+        JLOG("got total: " << vs.size() << ", last: " << vs.back());
+    });
+    waitForAll();
+}
+
+void ring1()
+{
+    const int PRODUCERS = 4;
+    const int CONSUMERS = 4;
+    const int VALUES = 10000;
+
+    ThreadPool tp(4, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    // small capacity: both senders and receivers are suspended
+    RingChannel<int> c(16);
+    std::atomic<int> producers(PRODUCERS);
+    std::atomic<long long> sum(0);
+    std::atomic<int> count(0);
+    goN(PRODUCERS, [&c, &producers] {
+        for (int i = 1; i <= VALUES; ++ i)
+            c.put(i);
+        if (-- producers == 0)
+            c.close();
+    });
+    goN(CONSUMERS, [&c, &sum, &count] {
+        for (int v: c)
+        {
+            sum += v;
+            ++ count;
+        }
+    });
+    waitForAll();
+    long long expected = (long long)PRODUCERS * VALUES * (VALUES + 1) / 2;
+    TLOG("count: " << count << ", sum: " << sum << ", expected: " << expected);
+}
+
+void select1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    Channel<int> c1;
+    Channel<Str> c2;
+    Channel<int> out(0);
+    go([&c1, &c2, &out] {
+        for (int n = 0; n < 3; ++ n)
+        {
+            int v;
+            Str s;
+            size_t i = Select().get(c1, v).get(c2, s).timeout(300).wait();
+            if (i == 0)
+                JLOG("c1: " << v);
+            else if (i == 1)
+                JLOG("c2: " << s);
+            else
+                JLOG("timed out: " << (i == Select::TIMEDOUT));
+        }
+        int v;
+        bool none = Select().get(c1, v).tryWait() == Select::NONE;
+        JLOG("default case: " << none);
+        size_t i = Select().put(out, 42).get(c1, v).wait();
+        JLOG("put case: " << i);
+        Select sel;
+        i = sel.get(c1, v).wait();
+        JLOG("closed case: " << i << ", ok: " << sel.ok());
+    });
+    go([&c1, &c2] {
+        sleepFor(50);
+        c2.put("hello");
+        sleepFor(50);
+        c1.put(1);
+    });
+    go([&c1, &out] {
+        int v = out.get();
+        JLOG("out: " << v);
+        c1.close();
+    });
+    waitForAll();
+}
+
+void select2()
+{
+    const int PRODUCERS = 4;
+    const int CONSUMERS = 3;
+    const int VALUES = 1000;
+    const int TOTAL = PRODUCERS * VALUES;
+
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    Channel<int> c1(0);
+    Channel<int> c2(4);
+    std::atomic<int> count(0);
+    std::atomic<long long> sum(0);
+    goN(PRODUCERS, [&c1, &c2] {
+        for (int i = 1; i <= VALUES; ++ i)
+            (i % 2 ? c1 : c2).put(i);
+    });
+    goN(CONSUMERS, [&c1, &c2, &count, &sum] {
+        while (true)
+        {
+            int v1, v2;
+            Select sel;
+            size_t i = sel.get(c1, v1).get(c2, v2).wait();
+            if (!sel.ok())
+                break;
+            sum += i == 0 ? v1 : v2;
+            if (++ count == TOTAL)
+            {
+                c1.close();
+                c2.close();
+            }
+        }
+    });
+    waitForAll();
+    long long expected = (long long)PRODUCERS * VALUES * (VALUES + 1) / 2;
+    TLOG("count: " << count << ", sum: " << sum << ", expected: " << expected);
+}
+
+// the outer timeout interrupts the blocked select and removes its waiters
+void select3()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    Channel<int> c1;
+    Channel<int> c2(0);
+    bool timedout = false;
+    go([&c1, &c2, &timedout] {
+        try
+        {
+            Timeout t(50);
+            int v;
+            Select().get(c1, v).put(c2, 5).wait();
+        }
+        catch (EventException& e)
+        {
+            JLOG("select interrupted: " << e.what());
+            timedout = e.status() == ES_TIMEDOUT;
+        }
+    });
+    waitForAll();
+    VERIFY(timedout, "Select must be interrupted by the timeout");
+    int v1 = 0, v2 = 0;
+    go([&c1, &c2, &v1, &v2] {
+        c1.put(1);
+        v1 = c1.get();
+        go([&c2] {
+            c2.put(2);
+        });
+        v2 = c2.get();
+    });
+    waitForAll();
+    VERIFY(v1 == 1 && v2 == 2, "Invalid channel values after the select");
+}
+
 void cycle1()
 {
     int threads = std::thread::hardware_concurrency();
@@ -150,15 +406,16 @@ void cycle1()
     {
         auto& ch = channels[i];
         auto& chNext = channels[i+1];
+        // tiny relay loops don't need large stacks
         go([&ch, &chNext] {
             while (true)
                 chNext.put(ch.get());
-        });
+        }, 1024*8);
     }
     go([&chFirst, &chLast, &counter] {
         for (;; ++ counter)
             chFirst.put(chLast.get());
-    });
+    }, 1024*8);
     for (int cur = counter, last = cur;; cur = last)
     {
         sleepFor(1000);
@@ -22,6 +22,14 @@ void pipe1();
 void pipe2();
 void pipe3();
 void pipe4();
+void pipe5();
+void bounded1();
+void rendezvous1();
+void ring1();
+void batch1();
+void select1();
+void select2();
+void select3();
 void cycle1();
 
 }
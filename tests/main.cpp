@@ -18,6 +18,7 @@
 
 #include "synca_tests.h"
 #include "data_tests.h"
+#include "bench_tests.h"
 #include "helpers.h"
 
 #define TESTS()   \
@@ -27,6 +28,8 @@
     TEST_ITERATOR(test::wait1) \
     TEST_ITERATOR(test::wait2) \
     TEST_ITERATOR(test::waitAny1)  \
+    TEST_ITERATOR(test::group1)  \
+    TEST_ITERATOR(test::group2)  \
     TEST_ITERATOR(test::resultAny1)    \
     TEST_ITERATOR(test::resultAny2)    \
     TEST_ITERATOR(test::resultAny3)    \
@@ -34,15 +37,44 @@
     TEST_ITERATOR(test::alone1)    \
     TEST_ITERATOR(test::timeout1)  \
     TEST_ITERATOR(test::timeout2)  \
+    TEST_ITERATOR(test::timeout3)  \
+    TEST_ITERATOR(test::deadline1)  \
+    TEST_ITERATOR(test::deadline2)  \
+    TEST_ITERATOR(test::iobuf1)  \
+    TEST_ITERATOR(test::reader1)  \
+    TEST_ITERATOR(test::write1)  \
+    TEST_ITERATOR(test::accept1)  \
+    TEST_ITERATOR(test::connpool1)  \
+    TEST_ITERATOR(test::dns1)  \
+    TEST_ITERATOR(test::flight1)  \
+    TEST_ITERATOR(test::cache1)  \
+    TEST_ITERATOR(test::file1)  \
+    TEST_ITERATOR(test::wheel1)  \
     TEST_ITERATOR(test::portal1)   \
     TEST_ITERATOR(test::portal2)   \
     TEST_ITERATOR(test::gc1)   \
     TEST_ITERATOR(test::tp1)   \
+    TEST_ITERATOR(test::stealing1) \
+    TEST_ITERATOR(test::waitAll1)  \
+    TEST_ITERATOR(test::handoff1)  \
+    TEST_ITERATOR(test::stack1)    \
+    TEST_ITERATOR(test::stack2)    \
+    TEST_ITERATOR(test::stack3)    \
     TEST_ITERATOR(data::pipe1) \
     TEST_ITERATOR(data::pipe2) \
     TEST_ITERATOR(data::pipe3) \
     TEST_ITERATOR(data::pipe4) \
+    TEST_ITERATOR(data::pipe5) \
+    TEST_ITERATOR(data::bounded1)  \
+    TEST_ITERATOR(data::rendezvous1)   \
+    TEST_ITERATOR(data::ring1) \
+    TEST_ITERATOR(data::batch1)    \
+    TEST_ITERATOR(data::select1)   \
+    TEST_ITERATOR(data::select2)   \
+    TEST_ITERATOR(data::select3)   \
     TEST_ITERATOR(data::cycle1)    \
+    TEST_ITERATOR(bench::cycle1)   \
+    TEST_ITERATOR(bench::cycle2)   \
 
 int main(int argc, char* argv[])
 {
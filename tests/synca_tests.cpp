@@ -14,10 +14,21 @@
  * limitations under the License.
  */
 
+#include <ctime>
+
 #include "core.h"
 #include "portal.h"
 #include "helpers.h"
 #include "gc.h"
+#include "stack.h"
+#include "stealing.h"
+#include "channel.h"
+#include "network.h"
+#include "connpool.h"
+#include "dnscache.h"
+#include "singleflight.h"
+#include "cache.h"
+#include "file.h"
 
 namespace test {
 
@@ -144,6 +155,85 @@ void waitAny1()
     waitForAll();
 }
 
+void group1()
+{
+    ThreadPool tp(3, "group");
+    scheduler<DefaultTag>().attach(tp);
+    std::atomic<int> counter(0);
+    std::atomic<int> cancelled(0);
+    std::string error;
+    go([&counter, &cancelled, &error] {
+        JourneyGroup group;
+        for (int i = 0; i < 10; ++ i) {
+            group.go([&counter] {
+                sleepFor(10);
+                ++ counter;
+            });
+        }
+        group.wait();
+        JLOG("completed: " << counter);
+        // the first error cancels the rest and is rethrown
+        group.go([] {
+            sleepFor(100);
+            RAISE("member error");
+        });
+        group.go([&cancelled] {
+            try {
+                while (true) {
+                    sleepFor(10);
+                    handleEvents();
+                }
+            } catch (EventException&) {
+                ++ cancelled;
+                throw;
+            }
+        });
+        try {
+            group.wait();
+        } catch (std::exception& e) {
+            JLOG("group error: " << e.what());
+            error = e.what();
+        }
+    });
+    waitForAll();
+    VERIFY(counter == 10, "All members must complete");
+    VERIFY(error.find("member error") != std::string::npos, "Member error must be rethrown");
+    VERIFY(cancelled == 1, "The rest must be cancelled on error");
+}
+
+void group2()
+{
+    ThreadPool tp(3, "group");
+    scheduler<DefaultTag>().attach(tp);
+    std::atomic<int> cancelled(0);
+    size_t index = JourneyGroup::NONE;
+    go([&cancelled, &index] {
+        JourneyGroup group;
+        // the loop occupies the thread until cancelled
+        for (int i = 0; i < 2; ++ i) {
+            group.go([&cancelled] {
+                try {
+                    while (true) {
+                        sleepFor(10);
+                        handleEvents();
+                    }
+                } catch (EventException&) {
+                    ++ cancelled;
+                    throw;
+                }
+            });
+        }
+        group.go([] {
+            sleepFor(100);
+        });
+        index = group.waitAny();
+        JLOG("index: " << index << ", cancelled: " << cancelled);
+    });
+    waitForAll();
+    VERIFY(index == 2, "Invalid first completed member");
+    VERIFY(cancelled == 2, "The losers must be cancelled");
+}
+
 void resultAny1()
 {
     ThreadPool tp(3, "result");
@@ -282,6 +372,730 @@ void timeout2()
     }, tp);
 }
 
+void timeout3()
+{
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    // listens before the client connects
+    net::Acceptor acceptor(8899);
+    bool serverTimedout = false;
+    bool clientFailed = false;
+    bool clientEvent = false;
+    // the timeout aborts the pending socket operations
+    go([&acceptor, &serverTimedout] {
+        net::Socket socket = acceptor.accept();
+        Buffer buffer(16, 0);
+        try {
+            Timeout t(100);
+            socket.read(buffer);
+        } catch (EventException& e) {
+            JLOG("server read: " << e.what());
+            serverTimedout = e.status() == ES_TIMEDOUT;
+        }
+    });
+    go([&clientFailed, &clientEvent] {
+        net::Socket socket;
+        socket.connect("127.0.0.1", 8899);
+        Buffer buffer(16, 0);
+        try {
+            Timeout t(300);
+            socket.read(buffer);
+        } catch (EventException& e) {
+            JLOG("client read: " << e.what());
+            clientEvent = true;
+        } catch (std::exception& e) {
+            // the server closes the socket first
+            JLOG("client read: " << e.what());
+            clientFailed = true;
+        }
+    });
+    waitForAll();
+    VERIFY(serverTimedout, "Server read must be aborted by the timeout");
+    VERIFY(clientFailed && !clientEvent, "Client read must fail on the closed socket before the timeout");
+}
+
+void deadline1()
+{
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    int64_t outer = -1, nested = -1, inner = -1, expired = -1;
+    bool acceptTimedout = false;
+    std::atomic<bool> childTimedout(false);
+    go([&outer, &nested, &inner, &expired, &acceptTimedout] {
+        Deadline d(100);
+        outer = deadlineLeft();
+        {
+            // the nested scope doesn't extend the deadline
+            Deadline d2(1000);
+            nested = deadlineLeft();
+            {
+                Deadline d3(50);
+                inner = deadlineLeft();
+            }
+        }
+        Deadline d2(1000);
+        net::Acceptor acceptor(8898);
+        try {
+            acceptor.accept();
+        } catch (EventException& e) {
+            expired = deadlineLeft();
+            JLOG("accept: " << e.what() << ", left ms: " << expired);
+            acceptTimedout = e.status() == ES_TIMEDOUT;
+        }
+    });
+    go([&childTimedout] {
+        Deadline d(100);
+        // the child inherits the deadline
+        go([&childTimedout] {
+            try {
+                while (true) {
+                    sleepFor(10);
+                    handleEvents();
+                }
+            } catch (EventException& e) {
+                JLOG("child: " << e.what());
+                childTimedout = e.status() == ES_TIMEDOUT;
+            }
+        });
+    });
+    waitForAll();
+    TLOG("left ms: " << outer << ", " << nested << ", " << inner << ", " << expired);
+    VERIFY(outer >= 0 && outer <= 100, "Invalid deadline budget");
+    VERIFY(nested >= 0 && nested <= outer, "Nested deadline must not extend the budget");
+    VERIFY(inner >= 0 && inner <= 50 && inner <= nested, "Nested deadline must tighten the budget");
+    VERIFY(expired == 0, "Budget must be exhausted");
+    VERIFY(acceptTimedout, "Accept must be aborted by the deadline");
+    VERIFY(childTimedout, "Child must inherit the deadline");
+}
+
+// the deadline interrupts the blocked channel operations
+void deadline2()
+{
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    Channel<int> values;
+    Channel<int> rendezvous(0);
+    int interrupted = 0;
+    go([&values, &rendezvous, &interrupted] {
+        try {
+            Deadline d(50);
+            values.get();
+        } catch (EventException& e) {
+            JLOG("get: " << e.what());
+            if (e.status() == ES_TIMEDOUT)
+                ++ interrupted;
+        }
+        try {
+            Deadline d(50);
+            rendezvous.put(1);
+        } catch (EventException& e) {
+            JLOG("put: " << e.what());
+            if (e.status() == ES_TIMEDOUT)
+                ++ interrupted;
+        }
+    });
+    waitForAll();
+    VERIFY(interrupted == 2, "Channel wait must be interrupted by the deadline");
+    // the interrupted waiters are removed from the channels
+    int v1 = 0, v2 = 0;
+    go([&values, &rendezvous, &v1, &v2] {
+        values.put(2);
+        v1 = values.get();
+        go([&rendezvous] {
+            rendezvous.put(3);
+        });
+        v2 = rendezvous.get();
+    });
+    waitForAll();
+    VERIFY(v1 == 2 && v2 == 3, "Invalid channel values after the deadline");
+}
+
+void iobuf1()
+{
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    // the slices are passed through the channel without copying
+    Channel<io::Chain> chunks;
+    // listens before the client connects
+    net::Acceptor acceptor(8897);
+    go([&acceptor, &chunks] {
+        net::Socket socket = acceptor.accept();
+        io::Chain data;
+        socket.read(data, 10000);
+        size_t pos = data.find("|");
+        io::Chain head = data.split(pos);
+        data.skip(1);
+        JLOG("head: " << head.str() << ", body size: " << data.size()
+            << ", slices: " << data.slices().size());
+        chunks.put(head);
+        chunks.put(data);
+        chunks.close();
+    });
+    size_t total = 0;
+    go([&chunks, &total] {
+        net::Socket socket;
+        socket.connect("127.0.0.1", 8897);
+        io::Chain data("header|");
+        data.append(Buffer(10000 - data.size(), 'x'));
+        socket.write(data);
+        for (auto&& c: chunks)
+            total += c.size();
+        JLOG("received: " << total);
+    });
+    waitForAll();
+    VERIFY(total == 10000 - 1, "All data except the separator must be received");
+}
+
+void reader1()
+{
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    // listens before the client connects
+    net::Acceptor acceptor(8896);
+    Buffer line1, line2, peeked, number, head, tail;
+    go([&] {
+        net::Socket socket = acceptor.accept();
+        net::StreamReader reader(socket);
+        line1 = reader.readLine();
+        line2 = reader.readLine();
+        peeked = reader.peek(3);
+        number = reader.readExactly(5);
+        head = reader.readUntil("||");
+        tail = reader.readExactly(4);
+        JLOG("read: " << line1 << ", " << line2 << ", " << peeked << ", "
+            << number << ", " << head << ", " << tail);
+    });
+    go([] {
+        net::Socket socket;
+        socket.connect("127.0.0.1", 8896);
+        // the delimiters are split between the writes
+        for (auto&& part: {"li", "ne1\r", "\nline2\n12", "345head|", "|tail"})
+        {
+            socket.write(part);
+            sleepFor(10);
+        }
+    });
+    waitForAll();
+    VERIFY(line1 == "line1" && line2 == "line2", "Invalid lines");
+    VERIFY(peeked == "123" && number == "12345", "Invalid data");
+    VERIFY(head == "head||" && tail == "tail", "Invalid data");
+}
+
+void write1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    const int writers = 10;
+    const int writes = 100;
+    // listens before the client connects
+    net::Acceptor acceptor(8895);
+    Buffer data;
+    net::WriteStats corked = {};
+    net::WriteStats total = {};
+    go([&acceptor, &data] {
+        net::Socket socket = acceptor.accept();
+        data.resize(writes + writers * writes);
+        socket.read(data);
+        JLOG("received: " << data.size());
+    });
+    go([&corked, &total] {
+        net::Socket socket;
+        socket.connect("127.0.0.1", 8895);
+        {
+            net::Cork cork(socket);
+            for (int i = 0; i < writes; ++ i)
+                socket.write("x");
+        }
+        corked = socket.writeStats();
+        JLOG("corked: writes " << corked.writes << ", sends " << corked.sends);
+        // concurrent writes are queued behind the write in flight
+        JourneyGroup group;
+        for (int i = 0; i < writers; ++ i)
+            group.go([&socket] {
+                for (int j = 0; j < writes; ++ j)
+                    socket.write("x");
+            });
+        group.wait();
+        socket.flush();
+        total = socket.writeStats();
+        JLOG("total: writes " << total.writes << ", sends " << total.sends
+            << ", bytes " << total.bytes);
+    });
+    waitForAll();
+    VERIFY(corked.sends == 1 && corked.bytes == writes, "Corked writes must be coalesced");
+    VERIFY(total.bytes == writes + writers * writes, "All data must be sent");
+    VERIFY(total.sends < total.writes, "Concurrent writes must be coalesced");
+    VERIFY(data.size() == size_t(writes + writers * writes)
+        && data.find_first_not_of('x') == std::string::npos, "Invalid data");
+}
+
+void accept1()
+{
+    ThreadPool tp(2, "tp");
+    ThreadPool w1(1, "w1");
+    ThreadPool w2(1, "w2");
+    scheduler<DefaultTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    const int clients = 20;
+    std::atomic<int> handled(0);
+    net::AcceptorOptions options;
+    options.batch = 8;
+    options.noDelay = true;
+    net::MultiAcceptor acceptor(8894, {&w1, &w2}, options);
+    go([&acceptor, &handled] {
+        acceptor.serve([&acceptor, &handled](const std::weak_ptr<net::Socket>& socket) {
+            Buffer data(1, 0);
+            socket.lock()->read(data);
+            JLOG("handled on " << mt::name());
+            if (++ handled == clients)
+                acceptor.close();
+        });
+        JLOG("serving completed: " << handled);
+    });
+    goN(clients, [] {
+        net::Socket socket;
+        socket.connect("127.0.0.1", 8894);
+        socket.write("x");
+    });
+    waitForAll();
+    VERIFY(handled == clients, "All clients must be handled");
+}
+
+void connpool1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<NetworkTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    net::Acceptor acceptor(8893);
+    go([&acceptor] {
+        try {
+            while (true)
+                acceptor.goAccept([](const std::weak_ptr<net::Socket>& socket) {
+                    // echoes the requests until the client closes the connection
+                    Buffer data(1, 0);
+                    try {
+                        while (true) {
+                            socket.lock()->read(data);
+                            socket.lock()->write(data);
+                        }
+                    } catch (std::exception&) {
+                    }
+                });
+        } catch (std::exception&) {
+        }
+    });
+    net::PoolStats used = {};
+    net::PoolStats idle = {};
+    bool timedout = false;
+    bool leased = false;
+    go([&] {
+        net::PoolOptions options;
+        options.maxTotal = 2;
+        options.idleTimeoutMs = 50;
+        options.evictPeriodMs = 10;
+        net::ConnectionPool pool(options);
+        JourneyGroup group;
+        for (int i = 0; i < 10; ++ i)
+            group.go([&pool] {
+                net::ConnectionPool::Lease conn = pool.lease("127.0.0.1", 8893);
+                Buffer data(1, 'x');
+                conn->write(data);
+                conn->read(data);
+            });
+        group.wait();
+        used = pool.stats();
+        JLOG("created: " << used.created << ", reused: " << used.reused << ", broken: "
+            << used.broken << ", waited: " << used.waited);
+        sleepFor(200);
+        idle = pool.stats();
+        JLOG("evicted: " << idle.evicted);
+        {
+            // the wait on the exhausted host is interrupted by the timeout
+            net::ConnectionPool::Lease c1 = pool.lease("127.0.0.1", 8893);
+            net::ConnectionPool::Lease c2 = pool.lease("127.0.0.1", 8893);
+            try {
+                Timeout t(50);
+                pool.lease("127.0.0.1", 8893);
+            } catch (EventException& e) {
+                JLOG("lease: " << e.what());
+                timedout = true;
+            }
+        }
+        // the host capacity is kept
+        Timeout t(1000);
+        net::ConnectionPool::Lease c1 = pool.lease("127.0.0.1", 8893);
+        net::ConnectionPool::Lease c2 = pool.lease("127.0.0.1", 8893);
+        leased = true;
+        acceptor.close();
+    });
+    waitForAll();
+    VERIFY(used.created <= 2 && used.created + used.reused == 10, "Connections must be reused");
+    VERIFY(idle.evicted == used.created, "Idle connections must be evicted");
+    VERIFY(timedout, "Lease must be interrupted by the timeout");
+    VERIFY(leased, "Pool must keep the host capacity");
+}
+
+void dns1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    std::atomic<int> lookups(0);
+    net::ResolverOptions options;
+    options.ttlMs = 100;
+    // offline backend: the lookup takes some time
+    net::CachingResolver resolver(options, [&lookups](const std::string& host) {
+        ++ lookups;
+        sleepFor(50);
+        if (host != "a.test")
+            RAISE("Host not found: " + host);
+        return net::EndPointList{net::EndPoint(boost::asio::ip::address::from_string("10.0.0.1"), 0)};
+    });
+    std::atomic<int> resolved(0);
+    goN(10, [&resolver, &resolved] {
+        net::EndPointList ends = resolver.resolve("a.test", 80);
+        if (ends.size() == 1 && ends[0].port() == 80)
+            ++ resolved;
+    });
+    waitForAll();
+    VERIFY(resolved == 10, "Invalid addresses");
+    VERIFY(lookups == 1, "Concurrent resolves must be coalesced");
+    int failed = 0;
+    go([&resolver, &failed] {
+        for (int i = 0; i < 2; ++ i) {
+            try {
+                resolver.resolve("b.test", 80);
+            } catch (std::runtime_error& e) {
+                JLOG("failed: " << e.what());
+                ++ failed;
+            }
+        }
+    });
+    waitForAll();
+    VERIFY(failed == 2, "Resolve must fail");
+    VERIFY(lookups == 2, "Failure must be cached");
+    sleepFor(150);
+    go([&resolver] {
+        resolver.resolve("a.test", 443);
+    });
+    waitForAll();
+    net::ResolverStats s = resolver.stats();
+    TLOG("hits: " << s.hits << ", misses: " << s.misses << ", coalesced: "
+        << s.coalesced << ", failures: " << s.failures);
+    VERIFY(lookups == 3 && s.misses == 3, "Expired address must be resolved again");
+}
+
+void flight1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    service<TimeoutTag>().attach(tp);
+    std::atomic<int> loads(0);
+    std::atomic<int> values(0);
+    std::atomic<int> errors(0);
+    SingleFlight<int, int> flight;
+    goN(10, [&] {
+        int v = flight.get(1, [&loads] {
+            ++ loads;
+            sleepFor(50);
+            return 10;
+        });
+        if (v == 10)
+            ++ values;
+    });
+    waitForAll();
+    VERIFY(values == 10, "Invalid value");
+    VERIFY(loads == 1, "Concurrent calls must be coalesced");
+    // the error is propagated to all waiters
+    goN(10, [&] {
+        try {
+            flight.get(2, [&loads]() -> int {
+                ++ loads;
+                sleepFor(50);
+                RAISE("Loading failed");
+            });
+        } catch (std::runtime_error&) {
+            ++ errors;
+        }
+    });
+    waitForAll();
+    TLOG("loads: " << loads << ", errors: " << errors << ", shared: " << flight.stats().shared);
+    VERIFY(loads == 2 && errors == 10, "Error must be shared");
+    // the waiter is interrupted by its timeout, the loader completes
+    std::atomic<int> timedout(0);
+    go([&] {
+        flight.get(3, [] {
+            sleepFor(100);
+            return 3;
+        });
+    });
+    sleepFor(10);
+    go([&] {
+        try {
+            Timeout t(20);
+            flight.get(3, [] {
+                return 0;
+            });
+        } catch (EventException&) {
+            ++ timedout;
+        }
+    });
+    waitForAll();
+    VERIFY(timedout == 1, "Waiter must be interrupted");
+    SingleFlight<int, int> memo(100, 100);
+    int v1 = 0, v2 = 0, v3 = 0;
+    int failures = 0;
+    go([&] {
+        auto load = [&loads] {
+            return ++ loads;
+        };
+        v1 = memo.get(1, load);
+        v2 = memo.get(1, load);
+        sleepFor(150);
+        v3 = memo.get(1, load);
+        // the error is memoized for its own time
+        for (int i = 0; i < 2; ++ i) {
+            try {
+                memo.get(2, [&loads]() -> int {
+                    ++ loads;
+                    RAISE("Loading failed");
+                });
+            } catch (std::runtime_error&) {
+                ++ failures;
+            }
+        }
+    });
+    waitForAll();
+    VERIFY(v1 == v2, "Result must be memoized");
+    VERIFY(v3 != v1, "Memoized result must expire");
+    VERIFY(failures == 2, "Error must be memoized");
+    VERIFY(memo.stats().memoized == 2 && memo.stats().loads == 3, "Invalid memoized count");
+}
+
+void cache1()
+{
+    // the entries of 10 bytes in the single shard
+    ShardedCache<std::string, std::string> clock(30, 1);
+    Buffer value(9, 'x');
+    clock.set("a", value);
+    clock.set("b", value);
+    clock.set("c", value);
+    // the referenced entries survive the sweep
+    clock.get("a");
+    clock.get("b");
+    clock.set("d", value);
+    VERIFY(clock.get("a") && clock.get("b") && clock.get("d"), "Entries must be present");
+    VERIFY(!clock.get("c"), "Entry must be evicted");
+    VERIFY(!clock.set("f", Buffer(30, 'x')), "Entry exceeds the budget");
+
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    ShardedCache<std::string, std::string> cache(16 * 1024);
+    goN(8, [&cache] {
+        for (int i = 0; i < 2000; ++ i) {
+            std::string key = std::to_string(i % 500);
+            if (!cache.get(key))
+                cache.set(key, Buffer(64, 'x'));
+        }
+    });
+    waitForAll();
+    CacheStats s = cache.stats();
+    TLOG("hits: " << s.hits << ", misses: " << s.misses << ", evictions: " << s.evictions
+        << ", bytes: " << s.bytes << ", hit ratio: " << s.hitRatio());
+    VERIFY(s.bytes <= 16 * 1024 && s.evictions > 0, "Budget must be kept");
+    VERIFY(s.hits + s.misses == 8 * 2000, "Invalid statistics");
+}
+
+void file1()
+{
+    ThreadPool tp(3, "tp");
+    ThreadPool disk(2, "disk");
+    scheduler<DefaultTag>().attach(tp);
+    scheduler<FileTag>().attach(disk);
+    service<TimeoutTag>().attach(tp);
+    const char* path = "synca_file1.tmp";
+    for (FileBackend backend: {FB_POOL, FB_AUTO}) {
+        setFileBackend(backend);
+        std::remove(path);
+        uint64_t size = 0, position = 0;
+        Buffer middle, tail, appended;
+        go([&] {
+            JLOG("backend: " << (fileBackend() == FB_URING ? "io_uring" : "pool"));
+            File f(path, File::FM_READ | File::FM_WRITE | File::FM_CREATE | File::FM_TRUNCATE);
+            f.write("hello ");
+            f.write("world");
+            f.pwrite("W", 6);
+            f.fsync();
+            size = f.size();
+            position = f.position();
+            middle.resize(5);
+            f.pread(middle, 6);
+            // the read at the end of the file is short
+            tail.resize(5);
+            f.read(tail);
+            File a(path, File::FM_READ | File::FM_WRITE | File::FM_APPEND);
+            a.write("!");
+            appended.resize(100);
+            f.pread(appended, 0);
+        });
+        waitForAll();
+        VERIFY(size == 11 && position == 11, "Invalid file size");
+        VERIFY(middle == "World", "Invalid data");
+        VERIFY(tail.empty(), "Data at the end of the file");
+        VERIFY(appended == "hello World!", "Invalid appended data");
+
+        std::remove(path);
+        go([path] {
+            LogStore store;
+            store.open(path);
+            store.set("a", "1");
+            store.set("b", "2");
+            store.set("a", "3");
+            store.sync();
+        });
+        waitForAll();
+        size_t keys = 0;
+        Buffer a, b, k7;
+        bool absent = false;
+        go([&] {
+            LogStore store;
+            store.open(path);
+            keys = store.size();
+            a = store.get("a").value_or("");
+            b = store.get("b").value_or("");
+            absent = !store.get("c");
+            // concurrent writes to the distinct records
+            JourneyGroup group;
+            for (int i = 0; i < 10; ++ i) {
+                group.go([&store, i] {
+                    store.set("k" + std::to_string(i), Buffer(1000 + i, 'x'));
+                });
+            }
+            group.wait();
+            // the torn record at the end
+            File f(path, File::FM_WRITE | File::FM_APPEND);
+            f.write(Buffer(20, 'z'));
+        });
+        waitForAll();
+        VERIFY(keys == 2, "Invalid replayed keys");
+        VERIFY(a == "3" && b == "2", "Invalid replayed values");
+        VERIFY(absent, "Unknown key must be absent");
+        Buffer c;
+        go([&] {
+            LogStore store;
+            store.open(path);
+            keys = store.size();
+            k7 = store.get("k7").value_or("");
+            store.set("c", "4");
+            LogStore replayed;
+            replayed.open(path);
+            c = replayed.get("c").value_or("");
+        });
+        waitForAll();
+        VERIFY(keys == 12, "Torn record must be discarded");
+        VERIFY(k7 == Buffer(1007, 'x'), "Invalid concurrent value");
+        VERIFY(c == "4", "Record must overwrite the torn tail");
+
+        // the expired deadline doesn't abort the started operation,
+        // the timeout is thrown at the next suspension
+        bool stored = false, timedout = false;
+        Buffer d;
+        go([&] {
+            LogStore store;
+            store.open(path);
+            try {
+                Deadline deadline(1);
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                store.set("d", "5");
+                stored = true;
+                handleEvents();
+            } catch (EventException& e) {
+                timedout = e.status() == ES_TIMEDOUT;
+            }
+            d = store.get("d").value_or("");
+        });
+        waitForAll();
+        VERIFY(stored && timedout, "File operation must not be aborted by the event");
+        VERIFY(d == "5", "Record must be indexed");
+    }
+    setFileBackend(FB_AUTO);
+    std::remove(path);
+}
+
+void wheel1()
+{
+    ThreadPool tp(2, "tp");
+    service<TimeoutTag>().attach(tp);
+    std::atomic<int> fired(0);
+    std::vector<std::unique_ptr<WheelTimer>> timers;
+    for (int i = 0; i < 1000; ++ i) {
+        timers.emplace_back(new WheelTimer);
+        timers.back()->start(wheel<TimeoutTag>(), 10 + i % 100, [&fired] {
+            ++ fired;
+        });
+    }
+    int cancelled = 0;
+    for (size_t i = 0; i < timers.size(); i += 2)
+        if (timers[i]->cancel())
+            ++ cancelled;
+    sleepFor(300);
+    TLOG("fired: " << fired << ", cancelled: " << cancelled);
+    // the timers armed in the middle of the tick don't fire early
+    const int delayed = 20;
+    std::vector<std::atomic<int64_t>> elapsed(delayed);
+    timers.clear();
+    for (int i = 0; i < delayed; ++ i) {
+        int64_t armed = nowNs();
+        std::atomic<int64_t>& e = elapsed[i];
+        e = 0;
+        timers.emplace_back(new WheelTimer);
+        timers.back()->start(wheel<TimeoutTag>(), 10, [&e, armed] {
+            e = nowNs() - armed;
+        });
+        sleepFor(1);
+    }
+    sleepFor(100);
+    int64_t least = INT64_MAX;
+    for (auto&& e: elapsed)
+        least = std::min<int64_t>(least, e);
+    TLOG("least elapsed: " << least / 1000 << " us");
+    VERIFY(least >= 10 * 1000000, "Timer must not fire early");
+    // the handlers cancel the sibling timers expired on the same tick
+    // and their own timers without waiting for themselves
+    timers.clear();
+    for (int i = 0; i < 3; ++ i)
+        timers.emplace_back(new WheelTimer);
+    std::atomic<int> handled(0), siblings(0), own(0);
+    for (int i = 0; i < 2; ++ i) {
+        WheelTimer& self = *timers[i];
+        WheelTimer& sibling = *timers[1 - i];
+        self.start(wheel<TimeoutTag>(), 10, [&self, &sibling, &handled, &siblings, &own] {
+            ++ handled;
+            if (sibling.cancel())
+                ++ siblings;
+            if (!self.cancel())
+                ++ own;
+        });
+    }
+    WheelTimer& last = *timers[2];
+    last.start(wheel<TimeoutTag>(), 10, [&timers] {
+        // the timer is destroyed by its handler
+        timers[2].reset();
+    });
+    sleepFor(100);
+    TLOG("handled: " << handled << ", siblings: " << siblings << ", own: " << own);
+    VERIFY(handled == 1 && siblings == 1 && own == 1, "Invalid cancel of the expired timers");
+    VERIFY(timers[2] == nullptr, "Timer handler must be invoked");
+}
+
 void portal1()
 {
     ThreadPool tp1(1, "tp1");
@@ -354,4 +1168,156 @@ void tp1()
     TLOG("7");
 }
 
+void stealing1()
+{
+    WorkStealingPool wsp(4, "wsp");
+    ThreadPool tp(1, "tp");
+    scheduler<DefaultTag>().attach(wsp);
+    service<TimeoutTag>().attach(wsp);
+    std::atomic<int> counter(0);
+    goN(1000, [&counter, &tp, &wsp] {
+        teleport(tp);
+        teleport(wsp);
+        ++ counter;
+    });
+    waitForAll();
+    TLOG("journeys completed: " << counter);
+    VERIFY(counter == 1000, "All journeys must complete");
+    // timer completion goes through the pool io service
+    bool timedout = false;
+    go([&tp, &wsp, &timedout] {
+        try {
+            Timeout t(100);
+            while (true) {
+                teleport(tp);
+                teleport(wsp);
+                handleEvents();
+            }
+        } catch (EventException& e) {
+            timedout = e.status() == ES_TIMEDOUT;
+        }
+    });
+    waitForAll();
+    TLOG("timeout completed");
+    VERIFY(timedout, "Timeout must interrupt the loop");
+    std::atomic<bool> slept(false);
+    go([&slept] {
+        sleepFor(100);
+        slept = true;
+    });
+    wsp.wait();
+    TLOG("wait completed");
+    VERIFY(slept, "Pool wait must wait for the journey");
+}
+
+void waitAll1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    std::atomic<int> counter(0);
+    goN(10, [&counter] {
+        goN(10, [&counter] {
+            sleepFor(30);
+            ++ counter;
+        });
+    });
+    // the blocked waiter doesn't consume the processor time
+    std::clock_t start = std::clock();
+    waitForAll();
+    TLOG("journeys completed: " << counter << ", waiting cpu ms: "
+        << (std::clock() - start) * 1000 / CLOCKS_PER_SEC);
+}
+
+void handoff1()
+{
+    ThreadPool tp1(1, "tp1");
+    ThreadPool tp2(1, "tp2");
+    scheduler<DefaultTag>().attach(tp1);
+    enableHandoff();
+
+    Channel<int> ping;
+    Channel<int> pong;
+    std::atomic<bool> done(false);
+    int count = 0;
+    go([&ping, &pong, &done, &count] {
+        for (; !done; ++ count)
+        {
+            ping.put(count);
+            pong.get();
+        }
+        ping.close();
+    });
+    go([&ping, &pong] {
+        for (int v: ping)
+            pong.put(v);
+    });
+    // ping-pong pair must not starve the journey on the same thread
+    go([&tp1, &tp2, &done] {
+        for (int i = 0; i < 100; ++ i)
+        {
+            teleport(tp2);
+            teleport(tp1);
+        }
+        JLOG("teleports completed");
+        done = true;
+    });
+    waitForAll();
+    enableHandoff(false);
+    TLOG("ping-pong count: " << count);
+    VERIFY(done, "Teleporting journey must complete");
+    VERIFY(count > 0, "Ping-pong must make progress");
+}
+
+void stack1()
+{
+    ThreadPool tp(3, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    coro::StackPool& pool = coro::stackPool();
+    size_t firstHits = 0;
+    for (int i = 0; i < 10; ++ i)
+    {
+        goN(100, [] {
+            sleepFor(1);
+        });
+        waitForAll();
+        RLOG("stacks: hits: " << pool.hits() << ", misses: " << pool.misses() << ", cached: " << pool.cached());
+        if (i == 0)
+            firstHits = pool.hits();
+    }
+    // the stacks released by the first round are reused
+    VERIFY(pool.hits() > firstHits, "Stacks must be reused");
+}
+
+int deepCall(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    return depth == 0 ? frame[0] : deepCall(depth - 1) + frame[0];
+}
+
+void stack2()
+{
+    // uses ~128KB: fits into the requested stack, beyond it hits the guard page
+    // (the default stack is 32KB without MMAP_STACK)
+    ThreadPool tp(1, "tp");
+    go([] {
+        JLOG("deep call: " << deepCall(128));
+    }, tp, 1024*256);
+    waitForAll();
+}
+
+void stack3()
+{
+    // peak usage is reported on journey destruction using STACK_STATS option
+    ThreadPool tp(2, "tp");
+    scheduler<DefaultTag>().attach(tp);
+    goN(3, [] {
+        JLOG("small stack");
+    }, 1024*8);
+    go([] {
+        JLOG("deep call: " << deepCall(512));
+    }, 1024*1024);
+    waitForAll();
+}
+
 }
@@ -24,6 +24,8 @@ void teleport_exception1();
 void wait1();
 void wait2();
 void waitAny1();
+void group1();
+void group2();
 void resultAny1();
 void resultAny2();
 void resultAny3();
@@ -31,9 +33,28 @@ void resultAny4();
 void alone1();
 void timeout1();
 void timeout2();
+void timeout3();
+void deadline1();
+void deadline2();
+void iobuf1();
+void reader1();
+void write1();
+void accept1();
+void connpool1();
+void dns1();
+void flight1();
+void cache1();
+void file1();
+void wheel1();
 void portal1();
 void portal2();
 void gc1();
 void tp1();
+void stealing1();
+void waitAll1();
+void handoff1();
+void stack1();
+void stack2();
+void stack3();
 
 }